@@ -10,7 +10,11 @@
 #include <QApplication>
 #include <QContextMenuEvent>
 #include <QMenu>
+#include <QMetaObject>
+#include <QMutexLocker>
 #include <QPaintEvent>
+#include <QRunnable>
+#include <QTimer>
 #include <QToolTip>
 
 #include "stddefs.H"
@@ -34,19 +38,111 @@ void split_smiles_into_atom_bits( const string &smiles ,
                                   vector<string> &bits );
 string extract_smarts_from_smirks( const std::string &smirks_string );
 // in eponymous file
+void count_subsearch_hits( OEMolBase &mol ,
+                           const vector<pair<boost::shared_ptr<OESubSearch>,string> > &sub_searches ,
+                           vector<unsigned int> &hit_counts ,
+                           vector<string> &hit_labels );
+// in eponymous file
 pair<QImage *,OE2DMolDisplay *> draw_oemol_to_qimage( QWidget *wid , OEMolBase &mol ,
                                                       bool coloured_mol ,
                                                       const vector<pair<OEAtomBase * , string> > &atom_labels ,
                                                       const vector<pair<OEAtomBase * , QColor> > &atom_colours ,
                                                       const vector<pair<OEBondBase * , QColor> > &bond_colours );
+pair<QImage *,OE2DMolDisplay *> draw_oemol_to_qimage( int width , int height , OEMolBase &mol ,
+                                                      bool coloured_mol ,
+                                                      const vector<pair<OEAtomBase * , string> > &atom_labels ,
+                                                      const vector<pair<OEAtomBase * , QColor> > &atom_colours ,
+                                                      const vector<pair<OEBondBase * , QColor> > &bond_colours );
+QImage *draw_oemol_skeleton_to_qimage( int width , int height , OEMolBase &mol );
 }
 
 namespace DACLIB {
 
+  // *******************************************************************************
+  // Draws a copy of a QTMolDisplay2D's molecule in the widget's render pool.
+  // The labels and colours refer to the atoms and bonds by index, as the
+  // widget's pointers are no use with the copy.
+  class QTMolRenderJob : public QRunnable {
+
+  public :
+
+    QTMolRenderJob( QTMolDisplay2D *disp , int generation , OEMolBase *mol ,
+                    const QSize &size , bool coloured_mol ,
+                    const vector<pair<unsigned int , string> > &atom_labels ,
+                    const vector<pair<unsigned int , QColor> > &atom_colours ,
+                    const vector<pair<unsigned int , QColor> > &bond_colours ) :
+      disp_( disp ) , generation_( generation ) , mol_( mol ) , size_( size ) ,
+      coloured_mol_( coloured_mol ) , atom_labels_( atom_labels ) ,
+      atom_colours_( atom_colours ) , bond_colours_( bond_colours ) {}
+
+    void run() {
+
+      if( !disp_->render_wanted( generation_ ) ) {
+        disp_->render_finished( generation_ , QImage() , boost::shared_ptr<OEMolBase>() ,
+                                boost::shared_ptr<OE2DMolDisplay>() );
+        return;
+      }
+
+      vector<pair<OEAtomBase * , string> > atom_labels;
+      for( int i = 0 , is = atom_labels_.size() ; i < is ; ++i ) {
+        OEAtomBase *atom = mol_->GetAtom( HasAtomIndex( atom_labels_[i].first ) );
+        if( atom ) {
+          atom_labels.push_back( make_pair( atom , atom_labels_[i].second ) );
+        }
+      }
+      vector<pair<OEAtomBase * , QColor> > atom_colours;
+      for( int i = 0 , is = atom_colours_.size() ; i < is ; ++i ) {
+        OEAtomBase *atom = mol_->GetAtom( HasAtomIndex( atom_colours_[i].first ) );
+        if( atom ) {
+          atom_colours.push_back( make_pair( atom , atom_colours_[i].second ) );
+        }
+      }
+      vector<pair<OEBondBase * , QColor> > bond_colours;
+      for( int i = 0 , is = bond_colours_.size() ; i < is ; ++i ) {
+        OEBondBase *bond = mol_->GetBond( HasBondIndex( bond_colours_[i].first ) );
+        if( bond ) {
+          bond_colours.push_back( make_pair( bond , bond_colours_[i].second ) );
+        }
+      }
+
+      pair<QImage *,OE2DMolDisplay *> img_disp =
+          draw_oemol_to_qimage( size_.width() , size_.height() , *mol_ , coloured_mol_ ,
+                                atom_labels , atom_colours , bond_colours );
+      QImage image = *img_disp.first;
+      delete img_disp.first;
+      disp_->render_finished( generation_ , image , mol_ ,
+                              boost::shared_ptr<OE2DMolDisplay>( img_disp.second ) );
+
+    }
+
+  private :
+
+    QTMolDisplay2D *disp_;
+    int generation_;
+    boost::shared_ptr<OEMolBase> mol_;
+    QSize size_;
+    bool coloured_mol_;
+    vector<pair<unsigned int , string> > atom_labels_;
+    vector<pair<unsigned int , QColor> > atom_colours_;
+    vector<pair<unsigned int , QColor> > bond_colours_;
+
+  };
+
   // *******************************************************************************
   QTMolDisplay2D::QTMolDisplay2D( QWidget *p , Qt::WindowFlags f ) :
-    QWidget( p , f ) , disp_mol_( 0 ) , coloured_mol_( true ) ,
-    min_font_size_( 6 ) , line_width_( 1 ) , background_colour_( QColor( "White" ) ) {
+    QWidget( p , f ) , coloured_mol_( true ) ,
+    min_font_size_( 6 ) , line_width_( 1 ) , background_colour_( QColor( "White" ) ) ,
+    depiction_stale_( true ) , async_render_( false ) , render_in_flight_( false ) ,
+    render_generation_( 0 ) , finished_generation_( -1 ) , lod_threshold_( 0 ) ,
+    lod_preview_( false ) , layout_pending_( false ) {
+
+    render_pool_.setMaxThreadCount( 1 );
+
+    lod_settle_timer_ = new QTimer( this );
+    lod_settle_timer_->setSingleShot( true );
+    lod_settle_timer_->setInterval( 300 );
+    connect( lod_settle_timer_ , SIGNAL( timeout() ) ,
+             this , SLOT( slot_lod_settled() ) );
 
     build_actions();
 
@@ -57,31 +153,74 @@ namespace DACLIB {
   // *******************************************************************************
   QTMolDisplay2D::~QTMolDisplay2D() {
 
-    delete disp_mol_;
+    // anything that hasn't started will see it's not wanted
+    render_generation_.fetchAndAddOrdered( 1 );
+    render_pool_.waitForDone();
 
   }
 
   // *******************************************************************************
   void QTMolDisplay2D::set_display_molecule( OEMolBase *new_mol ) {
 
-    if( disp_mol_ ) {
-      delete disp_mol_;
-    }
     atom_labels_.clear();
     atom_tooltips_.clear();
     atom_colours_.clear();
     sel_atoms_.clear();
+    placeholder_.clear();
 
     if( new_mol ) {
-      disp_mol_ = OENewMolBase( *new_mol , OEMolBaseType::OEDefault );
+      disp_mol_.reset( OENewMolBase( *new_mol , OEMolBaseType::OEDefault ) );
     } else {
-      disp_mol_ = 0;
+      disp_mol_.reset();
     }
 
-    if( disp_mol_ ) {
-      OEPrepareDepiction( *disp_mol_ , true );
+    // each new molecule puts the full depiction off again, so it's only done
+    // when the user stops on one. That includes the layout, which is most
+    // of the work for a big molecule, so the skeleton uses any 2D coords
+    // the molecule came with.
+    lod_preview_ = disp_mol_ && needs_lod( *disp_mol_ );
+    layout_pending_ = bool( disp_mol_ );
+    if( lod_preview_ ) {
+      lod_settle_timer_->start();
+    } else {
+      lod_settle_timer_->stop();
+      lay_out_molecule();
     }
 
+    if( toggle_atom_nums_->isChecked() ) {
+      number_atoms();
+    }
+    invalidate_depiction();
+
+  }
+
+  // *******************************************************************************
+  void QTMolDisplay2D::set_rendered_molecule( boost::shared_ptr<OEMolBase> new_mol ,
+                                              boost::shared_ptr<OE2DMolDisplay> new_disp ,
+                                              const QImage &new_image ,
+                                              const vector<unsigned int> &hit_counts ,
+                                              const vector<string> &hit_labels ) {
+
+    atom_labels_.clear();
+    bond_colours_.clear();
+    sel_atoms_.clear();
+    placeholder_.clear();
+
+    disp_mol_ = new_mol;
+    disp_ = new_disp;
+    disp_src_mol_ = disp_for_mol_ = new_mol;
+    set_hit_colours( hit_counts , hit_labels );
+    lod_preview_ = false;
+    layout_pending_ = false;
+    lod_settle_timer_->stop();
+
+    mol_image_ = new_image;
+    depiction_stale_ = false;
+    // anything in the render pool is out of date
+    render_generation_.fetchAndAddOrdered( 1 );
+
+    // this will invalidate the image, which is only right as it wasn't
+    // rendered with numbers.
     if( toggle_atom_nums_->isChecked() ) {
       number_atoms();
     }
@@ -92,13 +231,153 @@ namespace DACLIB {
   // *******************************************************************************
   void QTMolDisplay2D::clear_display_molecule() {
 
+    placeholder_.clear();
+    lod_preview_ = false;
+    layout_pending_ = false;
+    lod_settle_timer_->stop();
     if( disp_mol_ ) {
-      disp_mol_->Clear();
+      // disp_mol_ might be shared with whatever made it by
+      // set_rendered_molecule, so it's replaced rather than cleared.
+      disp_mol_.reset( OENewMolBase( OEMolBaseType::OEDefault ) );
+      disp_.reset();
       atom_labels_.clear();
       atom_tooltips_.clear();
       atom_colours_.clear();
       sel_atoms_.clear();
-      update();
+      invalidate_depiction();
+    }
+
+  }
+
+  // *******************************************************************************
+  void QTMolDisplay2D::set_placeholder( const QString &text ) {
+
+    clear_display_molecule();
+    placeholder_ = text;
+    invalidate_depiction();
+
+  }
+
+  // *******************************************************************************
+  void QTMolDisplay2D::set_lod_threshold( unsigned int num_heavy_atoms ,
+                                         int settle_ms ) {
+
+    lod_threshold_ = num_heavy_atoms;
+    lod_settle_timer_->setInterval( settle_ms );
+    if( !lod_threshold_ && lod_preview_ ) {
+      slot_lod_settled();
+    }
+
+  }
+
+  // *******************************************************************************
+  bool QTMolDisplay2D::needs_lod( OEMolBase &mol ) const {
+
+    return lod_threshold_ && OECount( mol , OEIsHeavy() ) > lod_threshold_;
+
+  }
+
+  // *******************************************************************************
+  void QTMolDisplay2D::set_preview_molecule( OEMolBase *new_mol ) {
+
+    atom_labels_.clear();
+    atom_tooltips_.clear();
+    atom_colours_.clear();
+    sel_atoms_.clear();
+    placeholder_.clear();
+
+    if( new_mol ) {
+      disp_mol_.reset( OENewMolBase( *new_mol , OEMolBaseType::OEDefault ) );
+    } else {
+      disp_mol_.reset();
+    }
+    // no timer, as the full depiction is coming from somewhere else.
+    lod_settle_timer_->stop();
+    lod_preview_ = true;
+    layout_pending_ = false;
+    invalidate_depiction();
+
+  }
+
+  // *******************************************************************************
+  // Only generate new 2D coords if the molecule doesn't already have some,
+  // such as ones stored from an earlier display of it. OEPrepareDepiction can
+  // delete hydrogens, so anything pointing into disp_mol_ is held by index
+  // while it runs and looked up again afterwards.
+  void QTMolDisplay2D::lay_out_molecule() {
+
+    if( !layout_pending_ ) {
+      return;
+    }
+    layout_pending_ = false;
+    if( !disp_mol_ ) {
+      return;
+    }
+
+    max_atom_index( *disp_mol_ );
+    max_bond_index( *disp_mol_ );
+
+    vector<pair<unsigned int , string> > atom_labels;
+    for( int i = 0 , is = atom_labels_.size() ; i < is ; ++i ) {
+      atom_labels.push_back( make_pair( atom_index( *atom_labels_[i].first ) ,
+                                        atom_labels_[i].second ) );
+    }
+    vector<pair<unsigned int , QString> > atom_tooltips;
+    for( int i = 0 , is = atom_tooltips_.size() ; i < is ; ++i ) {
+      atom_tooltips.push_back( make_pair( atom_index( *atom_tooltips_[i].first ) ,
+                                          atom_tooltips_[i].second ) );
+    }
+    vector<pair<unsigned int , QColor> > atom_colours;
+    for( int i = 0 , is = atom_colours_.size() ; i < is ; ++i ) {
+      atom_colours.push_back( make_pair( atom_index( *atom_colours_[i].first ) ,
+                                         atom_colours_[i].second ) );
+    }
+    vector<pair<unsigned int , QColor> > bond_colours;
+    for( int i = 0 , is = bond_colours_.size() ; i < is ; ++i ) {
+      bond_colours.push_back( make_pair( bond_index( *bond_colours_[i].first ) ,
+                                         bond_colours_[i].second ) );
+    }
+    vector<unsigned int> sel_atoms;
+    for( int i = 0 , is = sel_atoms_.size() ; i < is ; ++i ) {
+      sel_atoms.push_back( atom_index( *sel_atoms_[i] ) );
+    }
+
+    OEPrepareDepiction( *disp_mol_ , 2 != disp_mol_->GetDimension() );
+
+    atom_labels_.clear();
+    for( int i = 0 , is = atom_labels.size() ; i < is ; ++i ) {
+      OEAtomBase *atom = disp_mol_->GetAtom( HasAtomIndex( atom_labels[i].first ) );
+      if( atom ) {
+        atom_labels_.push_back( make_pair( atom , atom_labels[i].second ) );
+      }
+    }
+    atom_tooltips_.clear();
+    for( int i = 0 , is = atom_tooltips.size() ; i < is ; ++i ) {
+      OEAtomBase *atom = disp_mol_->GetAtom( HasAtomIndex( atom_tooltips[i].first ) );
+      if( atom ) {
+        atom_tooltips_.push_back( make_pair( atom , atom_tooltips[i].second ) );
+      }
+    }
+    atom_colours_.clear();
+    for( int i = 0 , is = atom_colours.size() ; i < is ; ++i ) {
+      OEAtomBase *atom = disp_mol_->GetAtom( HasAtomIndex( atom_colours[i].first ) );
+      if( atom ) {
+        atom_colours_.push_back( make_pair( atom , atom_colours[i].second ) );
+      }
+    }
+    bond_colours_.clear();
+    for( int i = 0 , is = bond_colours.size() ; i < is ; ++i ) {
+      OEBondBase *bond = disp_mol_->GetBond( HasBondIndex( bond_colours[i].first ) );
+      if( bond ) {
+        bond_colours_.push_back( make_pair( bond , bond_colours[i].second ) );
+      }
+    }
+    sel_atoms_.clear();
+    for( int i = 0 , is = sel_atoms.size() ; i < is ; ++i ) {
+      OEAtomBase *atom = disp_mol_->GetAtom( HasAtomIndex( sel_atoms[i] ) );
+      if( atom ) {
+        sel_atoms_.push_back( atom );
+      }
     }
 
   }
@@ -123,6 +402,8 @@ namespace DACLIB {
       atom_labels_.push_back( make_pair( atom , atnam ) );
     }
 
+    invalidate_depiction();
+
   }
 
   // *******************************************************************************
@@ -140,7 +421,7 @@ namespace DACLIB {
       }
     }
 
-    update();
+    invalidate_depiction();
 
   }
 
@@ -166,7 +447,7 @@ namespace DACLIB {
       }
     }
 
-    update();
+    invalidate_depiction();
 
   }
 
@@ -183,7 +464,7 @@ namespace DACLIB {
       }
     }
 
-    update();
+    invalidate_depiction();
 
   }
 
@@ -231,43 +512,35 @@ namespace DACLIB {
   // twice Orange, then Yellow, Green, Blue and Purple for > 5.
   void QTMolDisplay2D::colour_atoms( const vector<pair<boost::shared_ptr<OESubSearch>,string> > &sub_searches ) {
 
-    vector<int> hit_counts( disp_mol_->GetMaxAtomIdx() , 0 );
+    vector<unsigned int> hit_counts;
+    vector<string> hit_labels;
+    count_subsearch_hits( *disp_mol_ , sub_searches , hit_counts , hit_labels );
 
-    atom_tooltips_.clear();
+    colour_atoms_by_hit_counts( hit_counts , hit_labels );
 
-    for( int i = 0 , is = sub_searches.size() ; i < is ; ++i ) {
-      // unique matches only (that's the true bit in Match)
-      OEIter<OEMatchBase> match = sub_searches[i].first->Match( *disp_mol_ , true );
-      for( ; match ; ++match ) {
-        for( OEIter<OEAtomBase> ma = match->GetTargetAtoms() ; ma ; ++ma ) {
-          append_atom_tooltip( ma , sub_searches[i].second );
-          ++hit_counts[ma->GetIdx()];
-        }
-      }
-    }
+  }
 
-    static vector<QColor> count_colours;
-    if( count_colours.empty() ) {
-      count_colours.push_back( QColor( "Black") ); // shouldn't ever be used
-      count_colours.push_back( QColor( "Red") );
-      count_colours.push_back( QColor( "Orange") );
-      count_colours.push_back( QColor( "Yellow") );
-      count_colours.push_back( QColor( "Green") );
-      count_colours.push_back( QColor( "Blue") );
-      count_colours.push_back( QColor( "Purple") );
-    }
+  // *******************************************************************************
+  void QTMolDisplay2D::colour_atoms_by_hit_counts( const vector<unsigned int> &hit_counts ,
+                                                   const vector<string> &hit_labels ) {
 
-    atom_colours_.clear();
-    for( OEIter<OEAtomBase> at = disp_mol_->GetAtoms() ; at ; ++at ) {
-      unsigned int at_ind = at->GetIdx();
-      if( hit_counts[at_ind] > 0 && hit_counts[at_ind] < 6 ) {
-        atom_colours_.push_back( make_pair( at , count_colours[hit_counts[at_ind]] ) );
-      } else if( hit_counts[at_ind] > 5 ) {
-        atom_colours_.push_back( make_pair( at , count_colours[5] ) );
-      }
-    }
+    set_hit_colours( hit_counts , hit_labels );
+    invalidate_depiction();
 
-    update();
+  }
+
+  // *******************************************************************************
+  // This is used by the background rendering threads as well, so the table
+  // is initialised in one go, which is thread-safe, rather than filled in
+  // on the first call.
+  QColor QTMolDisplay2D::hit_count_colour( unsigned int hit_count ) {
+
+    static const QColor count_colours[] = { QColor( "Black" ) , // shouldn't ever be used
+                                            QColor( "Red" ) , QColor( "Orange" ) ,
+                                            QColor( "Yellow" ) , QColor( "Green" ) ,
+                                            QColor( "Blue" ) , QColor( "Purple" ) };
+
+    return count_colours[hit_count < 6 ? hit_count : 5];
 
   }
 
@@ -284,6 +557,8 @@ namespace DACLIB {
       }
     }
 
+    invalidate_depiction();
+
   }
 
   // *******************************************************************************
@@ -312,7 +587,7 @@ namespace DACLIB {
       }
     }
   
-    update();
+    invalidate_depiction();
 
   }
 
@@ -332,7 +607,7 @@ void QTMolDisplay2D::label_atoms_by_number( const std::vector<OEChem::OEAtomBase
     atom_labels_.push_back( make_pair( ma , atnam ) );
   }
 
-  update();
+  invalidate_depiction();
 
 }
 
@@ -353,7 +628,7 @@ void QTMolDisplay2D::label_atoms_by_map_idx() {
     }
   }
 
-  update();
+  invalidate_depiction();
 
 }
 
@@ -437,7 +712,7 @@ void QTMolDisplay2D::select_atoms_by_smarts( const std::string &smarts_string )
 void QTMolDisplay2D::set_line_width( int new_width ) {
 
   line_width_ = new_width;
-  update();
+  invalidate_depiction();
 
 }
 
@@ -445,10 +720,170 @@ void QTMolDisplay2D::set_line_width( int new_width ) {
   void QTMolDisplay2D::set_background_colour( const QColor &colour ) {
 
     background_colour_ = colour;
+    invalidate_depiction();
+
+  }
+
+  // *******************************************************************************
+  void QTMolDisplay2D::set_hit_colours( const vector<unsigned int> &hit_counts ,
+                                        const vector<string> &hit_labels ) {
+
+    atom_colours_.clear();
+    atom_tooltips_.clear();
+    if( !disp_mol_ ) {
+      return;
+    }
+
+    for( OEIter<OEAtomBase> at = disp_mol_->GetAtoms() ; at ; ++at ) {
+      unsigned int at_ind = DACLIB::atom_index( *at );
+      if( at_ind < hit_counts.size() && hit_counts[at_ind] ) {
+        atom_colours_.push_back( make_pair( at , hit_count_colour( hit_counts[at_ind] ) ) );
+      }
+      if( at_ind < hit_labels.size() && !hit_labels[at_ind].empty() ) {
+        append_atom_tooltip( at , hit_labels[at_ind] );
+      }
+    }
+
+  }
+
+  // *******************************************************************************
+  void QTMolDisplay2D::invalidate_depiction() {
+
+    depiction_stale_ = true;
+    render_generation_.fetchAndAddOrdered( 1 );
+    update();
+
+  }
+
+  // *******************************************************************************
+  void QTMolDisplay2D::set_async_rendering( bool new_val ) {
+
+    async_render_ = new_val;
+
+  }
+
+  // *******************************************************************************
+  void QTMolDisplay2D::slot_lod_settled() {
+
+    if( lod_preview_ ) {
+      lod_preview_ = false;
+      lay_out_molecule();
+      invalidate_depiction();
+    }
+
+  }
+
+  // *******************************************************************************
+  bool QTMolDisplay2D::render_wanted( int generation ) {
+
+    return generation == render_generation_.loadAcquire();
+
+  }
+
+  // *******************************************************************************
+  void QTMolDisplay2D::render_finished( int generation , const QImage &image ,
+                                        boost::shared_ptr<OEMolBase> mol ,
+                                        boost::shared_ptr<OE2DMolDisplay> disp ) {
+
+    {
+      QMutexLocker lock( &render_mutex_ );
+      finished_generation_ = generation;
+      finished_image_ = image;
+      finished_mol_ = mol;
+      finished_disp_ = disp;
+    }
+
+    QMetaObject::invokeMethod( this , "slot_render_finished" , Qt::QueuedConnection );
+
+  }
+
+  // *******************************************************************************
+  void QTMolDisplay2D::start_async_render() {
+
+    if( render_in_flight_ ) {
+      // slot_render_finished will come back for this one
+      return;
+    }
+
+    // the indices have to be there before the copy, or the copy will make
+    // its own, which might not be the same.
+    DACLIB::max_atom_index( *disp_mol_ );
+    DACLIB::max_bond_index( *disp_mol_ );
+
+    vector<pair<unsigned int , string> > atom_labels;
+    for( int i = 0 , is = atom_labels_.size() ; i < is ; ++i ) {
+      atom_labels.push_back( make_pair( DACLIB::atom_index( *atom_labels_[i].first ) ,
+                                        atom_labels_[i].second ) );
+    }
+    vector<pair<unsigned int , QColor> > atom_colours;
+    for( int i = 0 , is = atom_colours_.size() ; i < is ; ++i ) {
+      atom_colours.push_back( make_pair( DACLIB::atom_index( *atom_colours_[i].first ) ,
+                                         atom_colours_[i].second ) );
+    }
+    vector<pair<unsigned int , QColor> > bond_colours;
+    for( int i = 0 , is = bond_colours_.size() ; i < is ; ++i ) {
+      bond_colours.push_back( make_pair( DACLIB::bond_index( *bond_colours_[i].first ) ,
+                                         bond_colours_[i].second ) );
+    }
+
+    render_in_flight_ = true;
+    depiction_stale_ = false;
+    rendering_for_mol_ = disp_mol_;
+    render_pool_.start( new QTMolRenderJob( this , render_generation_.loadAcquire() ,
+                                            OENewMolBase( *disp_mol_ , OEMolBaseType::OEDefault ) ,
+                                            size() , coloured_mol_ ,
+                                            atom_labels , atom_colours , bond_colours ) );
+
+  }
+
+  // *******************************************************************************
+  void QTMolDisplay2D::slot_render_finished() {
+
+    int generation;
+    QImage image;
+    boost::shared_ptr<OEMolBase> mol;
+    boost::shared_ptr<OE2DMolDisplay> disp;
+    {
+      QMutexLocker lock( &render_mutex_ );
+      generation = finished_generation_;
+      image = finished_image_;
+      mol = finished_mol_;
+      disp = finished_disp_;
+      finished_image_ = QImage();
+      finished_mol_.reset();
+      finished_disp_.reset();
+    }
+
+    render_in_flight_ = false;
+    if( generation == render_generation_.loadAcquire() && disp ) {
+      mol_image_ = image;
+      disp_ = disp;
+      disp_src_mol_ = mol;
+      disp_for_mol_ = rendering_for_mol_;
+    } else {
+      // something's changed since it was asked for, so it needs doing again
+      depiction_stale_ = true;
+    }
+    rendering_for_mol_.reset();
     update();
 
   }
 
+  // *******************************************************************************
+  OE2DAtomDisplay *QTMolDisplay2D::atom_display( OEAtomBase *atom ) const {
+
+    if( !disp_ || !disp_mol_ || disp_for_mol_ != disp_mol_ ) {
+      return 0;
+    }
+    if( disp_src_mol_ == disp_mol_ ) {
+      return disp_->GetAtomDisplay( atom );
+    }
+
+    OEAtomBase *src_atom = disp_src_mol_->GetAtom( HasAtomIndex( DACLIB::atom_index( *atom ) ) );
+    return src_atom ? disp_->GetAtomDisplay( src_atom ) : 0;
+
+  }
+
   // *******************************************************************************
   void QTMolDisplay2D::build_actions() {
 
@@ -477,10 +912,12 @@ void QTMolDisplay2D::set_line_width( int new_width ) {
   }
 
   // *************************************************************************
-  void QTMolDisplay2D::squares_round_selected_atoms( QImage *image ) {
+  void QTMolDisplay2D::squares_round_selected_atoms( QPainter &qp ) {
+
+    if( !disp_ ) {
+      return;
+    }
 
-    QPainter qp( image );
-    qp.initFrom( this );
     qp.setRenderHint( QPainter::Antialiasing , true );
 
     int rect_size = int( width() / 100 );
@@ -489,7 +926,10 @@ void QTMolDisplay2D::set_line_width( int new_width ) {
     }
 
     for( int i = 0 , is = sel_atoms_.size() ; i < is ; ++i ) {
-      OE2DAtomDisplay *adisp = disp_->GetAtomDisplay( sel_atoms_[i] );
+      OE2DAtomDisplay *adisp = atom_display( sel_atoms_[i] );
+      if( !adisp ) {
+        continue;
+      }
       OE2DPoint cds = adisp->GetCoords();
       qp.setPen( "Orange" );
       qp.drawRect( int( cds.GetX() ) - rect_size , int( cds.GetY() ) - rect_size ,
@@ -516,12 +956,35 @@ void QTMolDisplay2D::set_line_width( int new_width ) {
     cout << "QTMolDisplay2D::paintEvent" << endl;
 #endif
 
-    QImage *mol_img = draw_molecule();
+    // only re-render the molecule if something about it has changed. Tooltips,
+    // exposes and atom selections just need the last image blitting again.
+    if( depiction_stale_ || mol_image_.size() != size() ) {
+      if( lod_preview_ && disp_mol_ && *disp_mol_ ) {
+        // there's no OE2DMolDisplay for the skeleton, so nothing to pick
+        // atoms from until the full depiction's done.
+        QImage *mol_img = draw_oemol_skeleton_to_qimage( width() , height() , *disp_mol_ );
+        mol_image_ = *mol_img;
+        delete mol_img;
+        disp_.reset();
+        depiction_stale_ = false;
+      } else if( async_render_ && disp_mol_ && *disp_mol_ ) {
+        // until it arrives, the last picture will have to do
+        lay_out_molecule();
+        start_async_render();
+      } else {
+        lay_out_molecule();
+        QImage *mol_img = draw_molecule();
+        mol_image_ = *mol_img;
+        delete mol_img;
+        depiction_stale_ = false;
+      }
+    }
 
     QPainter wp( this );
-    wp.drawImage( 0 , 0 , *mol_img );
+    wp.drawImage( 0 , 0 , mol_image_ );
 
-    delete mol_img;
+    // add selected atom squares - must be done after molecule rendering
+    squares_round_selected_atoms( wp );
 
   }
 
@@ -564,6 +1027,10 @@ void QTMolDisplay2D::set_line_width( int new_width ) {
 
       qp.setBackground( back_colour );
       qp.fillRect( rect() , back_colour );
+      if( !placeholder_.isEmpty() ) {
+        qp.setPen( Qt::gray );
+        qp.drawText( rect() , Qt::AlignCenter | Qt::TextWordWrap , placeholder_ );
+      }
       return ret_val;
     } else {
       pair<QImage *,OE2DMolDisplay *> img_mol_disp = draw_oemol_to_qimage( this , *disp_mol_ ,
@@ -571,9 +1038,7 @@ void QTMolDisplay2D::set_line_width( int new_width ) {
                                                                            atom_colours_ , bond_colours_ );
 
       disp_.reset( img_mol_disp.second );
-
-      // add selected atom squares - must be done after molecule rendering
-      squares_round_selected_atoms( img_mol_disp.first );
+      disp_src_mol_ = disp_for_mol_ = disp_mol_;
 
       return img_mol_disp.first;
     }
@@ -597,7 +1062,10 @@ void QTMolDisplay2D::set_line_width( int new_width ) {
 
     OEIter<OEAtomBase> atom;
     for( atom = disp_mol_->GetAtoms() ; atom ; ++atom ) {
-      OE2DAtomDisplay *adisp = disp_->GetAtomDisplay( atom );
+      OE2DAtomDisplay *adisp = atom_display( atom );
+      if( !adisp ) {
+        continue;
+      }
       OE2DPoint cds = adisp->GetCoords();
 
       int sq_dist = DACLIB::square( int( cds.GetX() ) - x_pos ) + DACLIB::square( int( cds.GetY() ) - y_pos );
@@ -664,7 +1132,7 @@ void QTMolDisplay2D::set_line_width( int new_width ) {
 
     if( toggle_atom_nums_->isChecked() ) {
       number_atoms();
-      update();
+      invalidate_depiction();
     } else {
       clear_atom_labels();
       update();
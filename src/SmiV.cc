@@ -5,11 +5,17 @@
 // 9th February 2009.
 
 #include "SmiV.H"
+#include "SmivDataFilter.H"
 #include "SmivDataTable.H"
+#include "SmiVDepictionExport.H"
 #include "SmiVFindMoleculeDialog.H"
+#include "SmiVFingerprints.H"
+#include "SmiVMolFiles.H"
 #include "SmiVPanel.H"
 #include "SmiVRecord.H"
+#include "SmiVRgroupAnalyser.H"
 #include "SmiVSettings.H"
+#include "SmiVTextIndex.H"
 
 #include "DACOEMolAtomIndex.H"
 #include "SMARTSExceptions.H"
@@ -17,12 +23,14 @@
 #include "QTSmartsEditDialog.H"
 #include "QTSmartsIntPickDialog.H"
 #include "QTSmilesEditDialog.H"
+#include "QTParallelFor.H"
 #include "stddefs.H"
 
 #include <QAction>
 #include <QApplication>
 #include <QFileDialog>
 #include <QFileInfo>
+#include <QHash>
 #include <QHeaderView>
 #include <QInputDialog>
 #include <QLayout>
@@ -32,12 +40,14 @@
 #include <QMenuBar>
 #include <QMessageBox>
 #include <QPushButton>
+#include <QSet>
 #include <QSlider>
 #include <QSplitter>
 #include <QStatusBar>
 #include <QTableView>
 
 #include <oechem.h>
+#include <oedepict.h>
 
 #include <fstream>
 #include <iostream>
@@ -46,21 +56,25 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/bind.hpp>
 #include <boost/foreach.hpp>
-#include <boost/iostreams/copy.hpp>
-#include <boost/iostreams/filtering_streambuf.hpp>
-#include <boost/iostreams/filter/gzip.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/regex.hpp>
 #include <boost/scoped_ptr.hpp>
 
 using namespace boost;
 using namespace std;
 using namespace OEChem;
+using namespace OEDepict;
 using namespace OESystem;
 
 extern string BUILD_TIME; // put together in build_time.cc
 
 namespace DACLIB {
   void apply_daylight_aromatic_model( OEMolBase &mol );
+  // in eponymous file
+  void count_subsearch_hits( OEMolBase &mol ,
+                             const vector<pair<boost::shared_ptr<OESubSearch>,string> > &sub_searches ,
+                             vector<unsigned int> &hit_counts ,
+                             vector<string> &hit_labels );
   void read_smarts_file( const string &smarts_file ,
                          vector<pair<string,string> > &input_smarts ,
                          vector<pair<string,string> > &smarts_sub_defn );
@@ -71,7 +85,35 @@ namespace DACLIB {
 }
 
 // ****************************************************************************
-SmiV::SmiV() : QMainWindow() , find_mol_dialog_( 0 ) , smiles_edit_dialog_( 0 ) {
+// Lays out molecules for SmiV::slot_generate_2d_layouts, in whichever thread
+// DACLIB::parallel_for puts it. The coordinates are put into coords rather
+// than straight into the records, so the GUI thread can do that at the end.
+class SmiVLayoutGenerator {
+
+public :
+
+  SmiVLayoutGenerator( const vector<pSmiVRec> &recs , vector<vector<float> > &coords ) :
+    recs_( recs ) , coords_( coords ) {}
+
+  void operator()( int rec_num , int worker_num __attribute__((unused)) ) {
+    OEGraphMol mol;
+    OEParseSmiles( mol , recs_[rec_num]->in_smi() );
+    DACLIB::create_atom_indices( mol );
+    OEPrepareDepiction( mol , true );
+    SmiVRecord::get_2d_coords( mol , coords_[rec_num] );
+  }
+
+private :
+
+  const vector<pSmiVRec> &recs_;
+  vector<vector<float> > &coords_;
+
+};
+
+// ****************************************************************************
+SmiV::SmiV() : QMainWindow() , find_mol_dialog_( 0 ) , smiles_edit_dialog_( 0 ) ,
+  live_search_panel_( 0 ) , live_search_mode_( 0 ) , num_similar_( 100 ) ,
+  cluster_threshold_( 0.7 ) , num_diverse_( 100 ) {
 
   build_actions();
   build_menubar();
@@ -90,9 +132,8 @@ SmiV::~SmiV() {
 }
 
 // ****************************************************************************
-void SmiV::parse_args( int argc , char **argv ) {
+void SmiV::parse_args( SmiVSettings &ss ) {
 
-  SmiVSettings ss( argc , argv );
   if( !ss ) {
     return; // it's not the end of the world
   }
@@ -212,10 +253,62 @@ void SmiV::slot_write_smiles() {
 
 }
 
+// ****************************************************************************
+void SmiV::slot_export_depictions() {
+
+  SmiVPanel *panel = get_active_panel();
+  if( panel->smiv_recs().empty() ) {
+    QMessageBox::warning( this , "Export Depictions" , "No molecules to export." );
+    return;
+  }
+
+  QString dir = QFileDialog::getExistingDirectory( this , "Export Depictions To" , last_dir_ );
+  if( dir.isEmpty() ) {
+    return;
+  }
+
+  QStringList formats;
+  const char *try_formats[] = { "png" , "svg" , "pdf" , "ps" , "jpg" , "bmp" };
+  for( int i = 0 , is = sizeof( try_formats ) / sizeof( try_formats[0] ) ; i < is ; ++i ) {
+    if( SmiVDepictionExport::can_write_format( try_formats[i] ) ) {
+      formats << try_formats[i];
+    }
+  }
+  bool ok = false;
+  QString format = QInputDialog::getItem( this , "Export Depictions" , "File format" ,
+                                          formats , 0 , false , &ok );
+  if( !ok ) {
+    return;
+  }
+
+  // rows and columns, 0 for one molecule per file
+  const int grids[4][2] = { { 0 , 0 } , { 3 , 4 } , { 4 , 5 } , { 5 , 6 } };
+  QStringList layouts;
+  layouts << "One molecule per file";
+  for( int i = 1 ; i < 4 ; ++i ) {
+    layouts << QString( "Pages of %1 rows x %2 columns" ).arg( grids[i][0] ).arg( grids[i][1] );
+  }
+  QString layout = QInputDialog::getItem( this , "Export Depictions" , "Layout" ,
+                                          layouts , 0 , false , &ok );
+  if( !ok ) {
+    return;
+  }
+  int grid_num = layouts.indexOf( layout );
+
+  SmiVDepictionExport exp( panel->smiv_recs() , panel->sub_searches() , panel->hits_key() );
+  exp.set_grid( grids[grid_num][0] , grids[grid_num][1] );
+  int num_written = exp.write( dir.toLocal8Bit().data() , format.toLocal8Bit().data() , this );
+  last_dir_ = dir;
+
+  statusBar()->showMessage( QString( "Wrote %1 files to %2." ).arg( num_written ).arg( dir ) , 2000 );
+
+}
+
 // ****************************************************************************
 void SmiV::slot_clear_molecules() {
 
   smiv_recs_.clear();
+  smiv_recs_changed();
   left_panel_->add_data( smiv_recs_ );
   right_panel_->add_data( smiv_recs_ );
   right_panel_->hide();
@@ -251,12 +344,165 @@ void SmiV::slot_find_mol() {
     find_mol_dialog_ = new SmiVFindMoleculeDialog( this );
     connect( find_mol_dialog_ , SIGNAL( molecule_search_name( QString , int ) ) ,
              this , SLOT( slot_molecule_search_name( QString , int ) ) );
+    connect( find_mol_dialog_ , SIGNAL( live_search_name( QString , int ) ) ,
+             this , SLOT( slot_live_search_name( QString , int ) ) );
+    connect( find_mol_dialog_ , SIGNAL( molecule_number_chosen( int ) ) ,
+             this , SLOT( slot_live_match_chosen( int ) ) );
   }
 
+  // so it's ready, or nearly, by the time the user's typed something
+  get_active_panel()->start_name_index();
   find_mol_dialog_->show();
 
 }
 
+// *****************************************************************************
+void SmiV::slot_find_smiles_text() {
+
+  find_smiles_text( false );
+
+}
+
+// *****************************************************************************
+void SmiV::slot_find_smiles_regex() {
+
+  find_smiles_text( true );
+
+}
+
+// *****************************************************************************
+// make a list of the molecules most like the current one in the active panel,
+// by Tanimoto on path fingerprints, most similar first.
+void SmiV::slot_find_similar() {
+
+  pSmiVRec query_rec = get_active_panel()->current_smiv_rec();
+  if( !query_rec || smiv_recs_.empty() ) {
+    QMessageBox::information( this , "Find Similar" , "No molecule to find similar ones to." );
+    return;
+  }
+
+  bool ok;
+  int num_similar = QInputDialog::getInt( this , "Find Similar" , "How many molecules?" ,
+                                          min( num_similar_ , int( smiv_recs_.size() ) ) ,
+                                          1 , smiv_recs_.size() , 1 , &ok );
+  if( !ok ) {
+    return;
+  }
+  num_similar_ = num_similar;
+
+  if( !make_fingerprints() ) {
+    return;
+  }
+
+  vector<quint64> query_fp( SmiVFingerprints::NUM_WORDS );
+  SmiVFingerprints::make_fingerprint( query_rec->in_smi() , &query_fp[0] );
+  vector<pair<float,int> > hits;
+  fingerprints_->most_similar( &query_fp[0] , num_similar , hits );
+  if( hits.empty() ) {
+    return;
+  }
+
+  vector<pSmiVRec> hit_recs;
+  hit_recs.reserve( hits.size() );
+  for( int i = 0 , is = hits.size() ; i < is ; ++i ) {
+    hit_recs.push_back( smiv_recs_[hits[i].second] );
+  }
+  set_mol_list( "Similar to " + query_rec->smi_name() , hit_recs );
+  statusBar()->showMessage( QString( "Tanimoto similarities from %1 to %2." )
+                            .arg( hits.front().first , 0 , 'f' , 3 )
+                            .arg( hits.back().first , 0 , 'f' , 3 ) , 5000 );
+
+}
+
+// *****************************************************************************
+// Butina clustering of the molecules in the active panel. They're shown
+// sorted by cluster, biggest first, with the centroid at the start of each,
+// and the biggest few clusters get lists of their own.
+void SmiV::slot_cluster_molecules() {
+
+  static const int MAX_CLUSTER_LISTS = 10;
+  // Every molecule's neighbours are kept while clustering, and below this
+  // there can be so many that they don't fit in memory.
+  static const double MIN_CLUSTER_THRESHOLD = 0.5;
+
+  vector<pSmiVRec> recs = get_active_panel()->smiv_recs();
+  if( recs.empty() ) {
+    QMessageBox::information( this , "Cluster Molecules" , "No molecules to cluster." );
+    return;
+  }
+
+  bool ok;
+  double threshold = QInputDialog::getDouble( this , "Cluster Molecules" ,
+                                              "Tanimoto threshold for neighbours :" ,
+                                              cluster_threshold_ , MIN_CLUSTER_THRESHOLD ,
+                                              1.0 , 2 , &ok );
+  if( !ok ) {
+    return;
+  }
+  cluster_threshold_ = threshold;
+
+  SmiVFingerprints fps;
+  vector<vector<int> > clusters;
+  if( !fingerprints_for( recs , fps ) || !fps.butina_clusters( threshold , clusters , this ) ) {
+    return;
+  }
+
+  QString thresh_str = QString::number( threshold , 'f' , 2 );
+  vector<pSmiVRec> sorted_recs;
+  sorted_recs.reserve( recs.size() );
+  for( int i = 0 , is = clusters.size() ; i < is ; ++i ) {
+    vector<pSmiVRec> clus_recs;
+    for( int j = 0 , js = clusters[i].size() ; j < js ; ++j ) {
+      clus_recs.push_back( recs[clusters[i][j]] );
+    }
+    if( i < MAX_CLUSTER_LISTS && clus_recs.size() > 1 ) {
+      set_mol_list( QString( "Cluster %1 at %2" ).arg( i + 1 ).arg( thresh_str ).toLocal8Bit().data() ,
+                    clus_recs , false );
+    }
+    sorted_recs.insert( sorted_recs.end() , clus_recs.begin() , clus_recs.end() );
+  }
+
+  set_mol_list( QString( "Clusters at %1" ).arg( thresh_str ).toLocal8Bit().data() , sorted_recs );
+  statusBar()->showMessage( QString( "%1 clusters, the biggest with %2 molecules." )
+                            .arg( clusters.size() ).arg( clusters.front().size() ) , 5000 );
+
+}
+
+// *****************************************************************************
+// MaxMin picking of a diverse subset of the molecules in the active panel,
+// starting with the first one, which becomes a new list in the order picked.
+void SmiV::slot_pick_diverse() {
+
+  vector<pSmiVRec> recs = get_active_panel()->smiv_recs();
+  if( recs.empty() ) {
+    QMessageBox::information( this , "Pick Diverse Subset" , "No molecules to pick from." );
+    return;
+  }
+
+  bool ok;
+  int num_diverse = QInputDialog::getInt( this , "Pick Diverse Subset" , "How many molecules?" ,
+                                          min( num_diverse_ , int( recs.size() ) ) ,
+                                          1 , recs.size() , 1 , &ok );
+  if( !ok ) {
+    return;
+  }
+  num_diverse_ = num_diverse;
+
+  SmiVFingerprints fps;
+  vector<int> picks;
+  if( !fingerprints_for( recs , fps ) || !fps.max_min_pick( num_diverse , picks , this ) ) {
+    return;
+  }
+
+  vector<pSmiVRec> pick_recs;
+  pick_recs.reserve( picks.size() );
+  for( int i = 0 , is = picks.size() ; i < is ; ++i ) {
+    pick_recs.push_back( recs[picks[i]] );
+  }
+  set_mol_list( QString( "Diverse %1" ).arg( picks.size() ).toLocal8Bit().data() , pick_recs );
+
+}
+
 // *****************************************************************************
 void SmiV::slot_smarts_match() {
 
@@ -269,6 +515,104 @@ void SmiV::slot_smarts_match() {
 
 }
 
+// *****************************************************************************
+// the data table needs a CoreSmarts column, the cores from which are used if
+// none of the SMARTS already read are cores.
+void SmiV::slot_rgroup_analysis() {
+
+  if( -1 == get_data_table_column_number( QString( "CoreSmarts" ) ) ) {
+    QMessageBox::information( this , "R Group Analysis" ,
+                              "The data table needs a CoreSmarts column for R Group analysis." );
+    return;
+  }
+  if( smiv_recs_.empty() ) {
+    QMessageBox::information( this , "R Group Analysis" , "No molecules to analyse." );
+    return;
+  }
+
+  if( !find_core_smarts() ) {
+    QMessageBox::information( this , "R Group Analysis" , "No core SMARTS to analyse with." );
+    return;
+  }
+
+  do_rgroup_analysis_of_core_smarts();
+
+}
+
+// *****************************************************************************
+// The decomposition of all the molecules by one of the cores goes straight to
+// a CSV file, which can then be read into the data table.
+void SmiV::slot_rgroup_decomposition() {
+
+  if( smiv_recs_.empty() ) {
+    QMessageBox::information( this , "R Group Decomposition" , "No molecules to decompose." );
+    return;
+  }
+  if( !find_core_smarts() ) {
+    QMessageBox::information( this , "R Group Decomposition" ,
+                              "No core SMARTS, either read in or in a CoreSmarts column of the data table." );
+    return;
+  }
+
+  vector<char> smarts_to_use( smarts_.size() , 0 );
+  for( int i = 0 , is = smarts_.size() ; i < is ; ++i ) {
+    smarts_to_use[i] = smarts_[i].first.substr( 0 , 4 ) == string( "core" );
+  }
+  vector<pair<boost::shared_ptr<OESubSearch>,string> > sub_searches;
+  QString smarts_list;
+  build_sub_searches_from_smarts( smarts_to_use , smarts_list , sub_searches );
+  SmiVRgroupAnalyser analyser( sub_searches );
+  if( !analyser.num_cores() ) {
+    return;
+  }
+
+  QStringList core_names;
+  for( int i = 0 , is = analyser.num_cores() ; i < is ; ++i ) {
+    core_names << analyser.core_name( i ).c_str();
+  }
+  bool ok;
+  QString core_name = QInputDialog::getItem( this , "R Group Decomposition" , "Core" ,
+                                             core_names , 0 , false , &ok );
+  if( !ok ) {
+    return;
+  }
+
+  QString filename =
+    QFileDialog::getSaveFileName( this , "R Group decomposition file" ,
+                                  last_dir_ , "CSV file (*.csv)" );
+  if( filename.isEmpty() ) {
+    return;
+  }
+  QFileInfo fi( filename );
+  last_dir_ = fi.absolutePath();
+
+  int num_rows = 0;
+  {
+    ofstream ofs( filename.toLocal8Bit().data() );
+    if( !ofs.good() ) {
+      QMessageBox::warning( this , "File Open Error" ,
+                            QString( "Couldn't open file \n%1\nfor writing." ).arg( filename ) );
+      return;
+    }
+    if( !analyser.decompose( smiv_recs_ , core_names.indexOf( core_name ) , ofs , num_rows , this ) ) {
+      statusBar()->showMessage( QString( "Cancelled after writing %1 molecules." ).arg( num_rows ) , 2000 );
+      return;
+    }
+  }
+
+  if( !num_rows ) {
+    QMessageBox::information( this , "R Group Decomposition" ,
+                              QString( "None of the molecules contain %1." ).arg( core_name ) );
+    return;
+  }
+  if( QMessageBox::Yes == QMessageBox::question( this , "R Group Decomposition" ,
+                                                 QString( "Wrote %1 molecules. Read them into the data table?" ).arg( num_rows ) ,
+                                                 QMessageBox::Yes | QMessageBox::No ) ) {
+    read_data_file( filename );
+  }
+
+}
+
 // *****************************************************************************
 void SmiV::slot_smarts_edit() {
 
@@ -361,6 +705,58 @@ void SmiV::slot_molecule_search_name( QString search_name , int search_mode ) {
 
 }
 
+// ****************************************************************************
+// list the first few molecules in the active panel that match what's been
+// typed into the find dialog so far.
+void SmiV::slot_live_search_name( QString search_name , int search_mode ) {
+
+  static const int MAX_LIVE_MATCHES = 20;
+
+  live_search_panel_ = get_active_panel();
+  live_search_name_ = search_name;
+  live_search_mode_ = search_mode;
+
+  vector<int> mol_nums;
+  if( !live_search_panel_->find_molecules( search_name.toLocal8Bit().data() , search_mode ,
+                                           MAX_LIVE_MATCHES + 1 , mol_nums ) ) {
+    // slot_name_index_ready will do it again.
+    find_mol_dialog_->set_matches_message( "Indexing molecule names..." );
+    return;
+  }
+
+  QStringList labels;
+  QList<int> match_nums;
+  for( int i = 0 , is = min( int( mol_nums.size() ) , MAX_LIVE_MATCHES ) ; i < is ; ++i ) {
+    labels << QString( "%1  (%2)" ).arg( live_search_panel_->smiv_rec( mol_nums[i] )->smi_name().c_str() )
+              .arg( mol_nums[i] + 1 );
+    match_nums << mol_nums[i];
+  }
+  find_mol_dialog_->set_matches( labels , match_nums ,
+                                 int( mol_nums.size() ) > MAX_LIVE_MATCHES );
+
+}
+
+// ****************************************************************************
+void SmiV::slot_live_match_chosen( int mol_num ) {
+
+  if( live_search_panel_ ) {
+    live_search_panel_->show_molecule_number( mol_num );
+  }
+
+}
+
+// ****************************************************************************
+// a panel's name index has been made in the background, so if the live search
+// was waiting for it, do it now.
+void SmiV::slot_name_index_ready() {
+
+  if( find_mol_dialog_ && find_mol_dialog_->isVisible() &&
+      sender() == live_search_panel_ && !live_search_name_.isEmpty() ) {
+    slot_live_search_name( live_search_name_ , live_search_mode_ );
+  }
+
+}
+
 // ****************************************************************************
 void SmiV::slot_panel_selection_changed( QWidget *panel ) {
 
@@ -431,6 +827,44 @@ void SmiV::slot_full_list() {
 
 }
 
+// ****************************************************************************
+// work out 2D coordinates for all molecules that haven't been displayed yet,
+// so that stepping through them later doesn't have to.
+void SmiV::slot_generate_2d_layouts() {
+
+  vector<pSmiVRec> to_do;
+  BOOST_FOREACH( pSmiVRec rec , smiv_recs_ ) {
+    if( !rec->has_2d_coords() ) {
+      to_do.push_back( rec );
+    }
+  }
+
+  vector<vector<float> > coords( to_do.size() );
+  SmiVLayoutGenerator layout_gen( to_do , coords );
+  DACLIB::parallel_for( layout_gen , to_do.size() , this ,
+                        QString( "Generating 2D layouts for %1 molecules." ).arg( to_do.size() ) );
+
+  // keep whatever was done, even if it was cancelled part way through
+  int num_done = 0;
+  for( int i = 0 , is = to_do.size() ; i < is ; ++i ) {
+    if( !coords[i].empty() ) {
+      to_do[i]->set_2d_coords( coords[i] );
+      ++num_done;
+    }
+  }
+
+  statusBar()->showMessage( QString( "Generated 2D layouts for %1 molecules." ).arg( num_done ) , 2000 );
+
+}
+
+// ****************************************************************************
+void SmiV::slot_grid_view( bool grid ) {
+
+  left_panel_->set_grid_mode( grid );
+  right_panel_->set_grid_mode( grid );
+
+}
+
 // ****************************************************************************
 void SmiV::slot_new_mol_list() {
 
@@ -473,6 +907,25 @@ void SmiV::slot_show_mol_list() {
 // ****************************************************************************
 void SmiV::slot_sort_data_table( int col_num ) {
 
+  // shift-click adds the column to the ones already sorted on, to break
+  // their ties, or flips it if it's already there.
+  vector<pair<int,Qt::SortOrder> > sort_keys = data_table_->sort_keys();
+  if( ( QApplication::keyboardModifiers() & Qt::ShiftModifier ) && !sort_keys.empty() ) {
+    int i = 0 , is = sort_keys.size();
+    for( ; i < is ; ++i ) {
+      if( col_num == sort_keys[i].first ) {
+        sort_keys[i].second = Qt::AscendingOrder == sort_keys[i].second ?
+              Qt::DescendingOrder : Qt::AscendingOrder;
+        break;
+      }
+    }
+    if( i == is ) {
+      sort_keys.push_back( make_pair( col_num , Qt::AscendingOrder ) );
+    }
+    data_table_->sort( sort_keys );
+    return;
+  }
+
   if( Qt::DescendingOrder == data_table_->last_sort_order() ) {
     data_table_->sort( col_num , Qt::AscendingOrder );
   } else {
@@ -503,16 +956,84 @@ void SmiV::slot_data_table_cell_double_clicked( const QModelIndex &ind ) {
 }
 
 // *****************************************************************************************
-void SmiV::slot_data_table_show_row( QString row_name ) {
+// Show just the rows of the table that pass the filter expression, and make
+// a list of the molecules named in them, which is then shown.
+void SmiV::slot_filter_data_table() {
+
+  QString expr = data_filter_->text().trimmed();
+  if( expr.isEmpty() ) {
+    slot_clear_data_table_filter();
+    return;
+  }
+
+  SmivDataFilter filter( *data_table_ );
+  if( !filter.parse( expr ) ) {
+    QMessageBox::warning( this , "Filter Error" , filter.error() );
+    return;
+  }
+  // the filter works on the whole table, so it all has to be read in
+  if( !data_table_->fetch_all() ) {
+    return;
+  }
+  vector<char> row_mask;
+  filter.evaluate( row_mask );
+  data_table_->set_row_filter( row_mask );
 
   // assume the compound name is in the first column of the table
-  for( unsigned int i = 0 , is = data_table_->rowCount() ; i < is ; ++i ) {
-    if( data_table_->data( i , 0 ).toString() == row_name ) {
-      data_table_view_->scrollTo( data_table_->index( i , 0 ) );
-      break;
+  QSet<QString> row_names;
+  const SmivDataColumn &name_col = data_table_->column( 0 );
+  for( int i = 0 , is = row_mask.size() ; i < is ; ++i ) {
+    if( row_mask[i] ) {
+      row_names.insert( name_col.value( i ).toString() );
+    }
+  }
+  vector<pSmiVRec> filter_recs;
+  for( int i = 0 , is = smiv_recs_.size() ; i < is ; ++i ) {
+    if( row_names.contains( QString( smiv_recs_[i]->smi_name().c_str() ) ) ) {
+      filter_recs.push_back( smiv_recs_[i] );
     }
   }
 
+  statusBar()->showMessage( QString( "%1 rows and %2 molecules passed the filter." )
+                            .arg( data_table_->rowCount() ).arg( filter_recs.size() ) , 5000 );
+  if( filter_recs.empty() ) {
+    return;
+  }
+
+  set_mol_list( string( ( "Filter : " + expr ).toLocal8Bit().data() ) , filter_recs );
+
+}
+
+// *****************************************************************************************
+void SmiV::slot_clear_data_table_filter() {
+
+  data_filter_->clear();
+  data_table_->clear_row_filter();
+
+}
+
+// *****************************************************************************************
+void SmiV::slot_data_table_show_row( QString row_name ) {
+
+  data_table_row_name_ = row_name;
+  // assume the compound name is in the first column of the table
+  int row_num = data_table_->row_for_name( row_name );
+  if( -1 != row_num ) {
+    data_table_->fetch_to( row_num );
+    data_table_view_->scrollTo( data_table_->index( row_num , 0 ) );
+  }
+
+}
+
+// *****************************************************************************************
+// the names of a big data file have been hashed in the background, so the
+// row for the molecule on show can be found now.
+void SmiV::slot_data_table_name_rows_ready() {
+
+  if( !data_table_row_name_.isEmpty() ) {
+    slot_data_table_show_row( data_table_row_name_ );
+  }
+
 }
 
 // ****************************************************************************
@@ -533,6 +1054,10 @@ void SmiV::build_file_actions() {
   file_read_data_->setStatusTip( "Read arbitrary data file into table" );
   connect( file_read_data_ , SIGNAL( triggered() ) , this , SLOT( slot_file_read_data() ) );
 
+  file_export_depictions_ = new QAction( "Export Depictions" , this );
+  file_export_depictions_->setStatusTip( "Write pictures of the molecules in the current panel to files" );
+  connect( file_export_depictions_ , SIGNAL( triggered() ) , this , SLOT( slot_export_depictions() ) );
+
   file_quit_ = new QAction( "Quit" , this );
   file_quit_->setShortcut( QString( "Ctrl+Q" ) );
   file_quit_->setStatusTip( "Exit the application" );
@@ -572,6 +1097,21 @@ void SmiV::build_smarts_actions() {
   connect( clear_smarts_ , SIGNAL( triggered() ) ,
            this , SLOT( slot_clear_smarts() ) );
 
+  rgroup_analysis_ = new QAction( "R Group Analysis of Cores" , this );
+  rgroup_analysis_->setStatusTip( "Count the substituted positions and distinct R Groups of each core in the CoreSmarts column of the data table" );
+  connect( rgroup_analysis_ , SIGNAL( triggered() ) ,
+           this , SLOT( slot_rgroup_analysis() ) );
+
+  rgroup_decomp_ = new QAction( "R Group Decomposition by Core" , this );
+  rgroup_decomp_->setStatusTip( "Write the R Groups on each atom of a core, for all the molecules containing it, to a CSV file" );
+  connect( rgroup_decomp_ , SIGNAL( triggered() ) ,
+           this , SLOT( slot_rgroup_decomposition() ) );
+
+  smarts_keep_hits_ = new QAction( "Keep Match Highlights" , this );
+  smarts_keep_hits_->setCheckable( true );
+  smarts_keep_hits_->setChecked( false );
+  smarts_keep_hits_->setStatusTip( "Store the matched atoms when matching, rather than searching again for each display. Matching is slower, as it finds every match rather than stopping at the first." );
+
 }
 
 // **************************************************************************
@@ -608,6 +1148,26 @@ void SmiV::build_molecule_actions() {
   connect( find_mol_ , SIGNAL( triggered() ) ,
            this , SLOT( slot_find_mol() ) );
 
+  find_smiles_text_ = new QAction( "Find SMILES Text" , this );
+  connect( find_smiles_text_ , SIGNAL( triggered() ) ,
+           this , SLOT( slot_find_smiles_text() ) );
+
+  find_smiles_regex_ = new QAction( "Find SMILES Regex" , this );
+  connect( find_smiles_regex_ , SIGNAL( triggered() ) ,
+           this , SLOT( slot_find_smiles_regex() ) );
+
+  find_similar_ = new QAction( "Find Similar to Current Molecule" , this );
+  connect( find_similar_ , SIGNAL( triggered() ) ,
+           this , SLOT( slot_find_similar() ) );
+
+  cluster_mols_ = new QAction( "Cluster Molecules" , this );
+  connect( cluster_mols_ , SIGNAL( triggered() ) ,
+           this , SLOT( slot_cluster_molecules() ) );
+
+  pick_diverse_ = new QAction( "Pick Diverse Subset" , this );
+  connect( pick_diverse_ , SIGNAL( triggered() ) ,
+           this , SLOT( slot_pick_diverse() ) );
+
   input_smiles_ = new QAction( "Input SMILES" , this );
   connect( input_smiles_ , SIGNAL( triggered() ) ,
            this , SLOT( slot_input_smiles() ) );
@@ -630,6 +1190,18 @@ void SmiV::build_molecule_actions() {
   connect( full_list_ , SIGNAL( triggered() ) ,
            this , SLOT( slot_full_list() ) );
 
+  generate_layouts_ = new QAction( "Generate 2D Layouts" , this );
+  generate_layouts_->setStatusTip( "Lay out all molecules in advance, for quicker display" );
+  connect( generate_layouts_ , SIGNAL( triggered() ) ,
+           this , SLOT( slot_generate_2d_layouts() ) );
+
+  grid_view_ = new QAction( "Grid View" , this );
+  grid_view_->setShortcut( QString( "Ctrl+G" ) );
+  grid_view_->setCheckable( true );
+  grid_view_->setStatusTip( "Show a page of molecules at a time" );
+  connect( grid_view_ , SIGNAL( toggled( bool ) ) ,
+           this , SLOT( slot_grid_view( bool ) ) );
+
   clear_mols_ = new QAction( "Clear Molecules" , this );
   connect( clear_mols_ , SIGNAL( triggered() ) ,
            this , SLOT( slot_clear_molecules() ) );
@@ -655,6 +1227,7 @@ void SmiV::build_menubar() {
   file_menu->addAction( file_reread_smarts_ );
   file_menu->addAction( file_read_mdl_query_ );
   file_menu->addAction( file_read_data_ );
+  file_menu->addAction( file_export_depictions_ );
   file_menu->addSeparator();
   file_menu->addAction( file_quit_ );
 
@@ -666,6 +1239,11 @@ void SmiV::build_menubar() {
   smarts_menu->addAction( file_reread_smarts_ );
   smarts_menu->addAction( smarts_write_ );
   smarts_menu->addAction( clear_smarts_ );
+  smarts_menu->addSeparator();
+  smarts_menu->addAction( rgroup_analysis_ );
+  smarts_menu->addAction( rgroup_decomp_ );
+  smarts_menu->addSeparator();
+  smarts_menu->addAction( smarts_keep_hits_ );
 
   QMenu *mdl_query_menu = menuBar()->addMenu( "MDL Query" );
   mdl_query_menu->addAction( mdl_query_match_ );
@@ -675,8 +1253,15 @@ void SmiV::build_menubar() {
   mol_menu->addAction( file_reread_mol_ );
   mol_menu->addAction( file_write_smiles_ );
   mol_menu->addAction( find_mol_ );
+  mol_menu->addAction( find_smiles_text_ );
+  mol_menu->addAction( find_smiles_regex_ );
+  mol_menu->addAction( find_similar_ );
+  mol_menu->addAction( cluster_mols_ );
+  mol_menu->addAction( pick_diverse_ );
   mol_menu->addAction( input_smiles_ );
   mol_menu->addAction( edit_smiles_ );
+  mol_menu->addAction( generate_layouts_ );
+  mol_menu->addAction( grid_view_ );
   mol_menu->addAction( clear_mols_ );
   mol_lists_menu_ = mol_menu->addMenu( "Lists");
   mol_lists_menu_->addAction( full_list_ );
@@ -705,6 +1290,8 @@ void SmiV::build_widget() {
            this , SLOT( slot_panel_selection_changed( QWidget * ) ) );
   connect( left_panel_ , SIGNAL( new_display_mol( QString ) ) ,
            this , SLOT( slot_data_table_show_row( QString ) ) );
+  connect( left_panel_ , SIGNAL( name_index_ready() ) ,
+           this , SLOT( slot_name_index_ready() ) );
 
   right_panel_ = new SmiVPanel;
   hbox->addWidget( right_panel_ );
@@ -714,11 +1301,14 @@ void SmiV::build_widget() {
            this , SLOT( slot_panel_selection_changed( QWidget * ) ) );
   connect( right_panel_ , SIGNAL( new_display_mol( QString ) ) ,
            this , SLOT( slot_data_table_show_row( QString ) ) );
+  connect( right_panel_ , SIGNAL( name_index_ready() ) ,
+           this , SLOT( slot_name_index_ready() ) );
 
   data_table_ = new SmivDataTable;
+  connect( data_table_ , SIGNAL( name_rows_ready() ) ,
+           this , SLOT( slot_data_table_name_rows_ready() ) );
   data_table_view_ = new QTableView;
   data_table_view_->setModel( data_table_ );
-  data_table_view_->hide();
   connect( data_table_view_->horizontalHeader() , SIGNAL( sectionClicked( int ) ) ,
            this , SLOT( slot_sort_data_table( int ) ) );
 
@@ -728,7 +1318,28 @@ void SmiV::build_widget() {
   QWidget *hbox_wid = new QWidget;
   hbox_wid->setLayout( hbox );
   splitter->addWidget( hbox_wid );
-  splitter->addWidget( data_table_view_ );
+
+  // the filter bar goes above the table, and they're hidden together until
+  // there's some data.
+  data_filter_ = new QLineEdit;
+  data_filter_->setPlaceholderText( "e.g. MW < 500 && AllDon <= 5" );
+  connect( data_filter_ , SIGNAL( returnPressed() ) ,
+           this , SLOT( slot_filter_data_table() ) );
+  QPushButton *clear_filter = new QPushButton( "Clear" );
+  connect( clear_filter , SIGNAL( clicked() ) ,
+           this , SLOT( slot_clear_data_table_filter() ) );
+  QHBoxLayout *filter_hbox = new QHBoxLayout;
+  filter_hbox->addWidget( new QLabel( "Filter" ) );
+  filter_hbox->addWidget( data_filter_ , 1 );
+  filter_hbox->addWidget( clear_filter );
+  QVBoxLayout *table_vbox = new QVBoxLayout;
+  table_vbox->setContentsMargins( 0 , 0 , 0 , 0 );
+  table_vbox->addLayout( filter_hbox );
+  table_vbox->addWidget( data_table_view_ , 1 );
+  data_table_wid_ = new QWidget;
+  data_table_wid_->setLayout( table_vbox );
+  data_table_wid_->hide();
+  splitter->addWidget( data_table_wid_ );
   setCentralWidget( splitter );
 
 }
@@ -736,6 +1347,7 @@ void SmiV::build_widget() {
 // ****************************************************************************
 void SmiV::read_mol_file( const QString &filename ) {
 
+  smiv_recs_changed();
   QFileInfo fi( filename );
   if( !fi.exists() ) {
     return;
@@ -764,44 +1376,7 @@ void SmiV::read_smiles_file( const QString &filename ) {
   }
 
   last_dir_ = fi.absolutePath();
-
-  ifstream file( filename.toLocal8Bit().data() , ios_base::in | ios_base::binary );
-  boost::iostreams::filtering_streambuf<boost::iostreams::input> in;
-  if( filename.endsWith( ".smi.gz" ) ) {
-    in.push( boost::iostreams::gzip_decompressor() );
-  }
-  in.push( file );
-
-  istreambuf_iterator<char> init( &in ) , eos;
-
-  vector<char> nextline;
-  vector<pair<string,string> > in_smiles;
-
-  while( init != eos ) {
-    nextline.clear();
-    while( init != eos && *init != '\n' ) {
-      nextline.push_back( *init );
-      ++init;
-    }
-    boost::trim( nextline );
-    if( !nextline.empty() ) {
-      vector<string> split_line;
-      split( split_line , nextline , is_any_of( " ,\t" ) );
-      if( !split_line.empty() ) {
-        string mol_name;
-        if( split_line.size() > 1 ) {
-          mol_name = string( nextline.begin() + split_line[0].length() + 1 ,
-                             nextline.end() );
-          boost::trim( mol_name );
-        } else {
-          mol_name = string( "Mol" ) + lexical_cast<string>( smiv_recs_.size() + 1 );
-        }
-        SmiVRecord *smiv_rec = new SmiVRecord( split_line[0] , mol_name );
-        smiv_recs_.push_back( pSmiVRec( smiv_rec ) );
-      }
-    }
-    ++init; // get past '\n'
-  }
+  ::read_smiles_file( filename.toLocal8Bit().data() , smiv_recs_ );
 
 }
 
@@ -814,14 +1389,7 @@ void SmiV::read_other_mol_file( const QString &filename ) {
   }
 
   last_dir_ = fi.absolutePath();
-
-  oemolistream ims( filename.toLocal8Bit().data() );
-  OEMol mol;
-  while( ims >> mol ) {
-    DACLIB::apply_daylight_aromatic_model( mol );
-    SmiVRecord *smiv_rec = new SmiVRecord( mol );
-    smiv_recs_.push_back( pSmiVRec( smiv_rec ) );
-  }
+  ::read_other_mol_file( filename.toLocal8Bit().data() , smiv_recs_ );
 
 }
 
@@ -865,33 +1433,12 @@ void SmiV::read_mdl_query_file( const QString &filename ) {
 
   last_dir_ = fi.absolutePath();
 
-  ifstream ifs( filename.toLocal8Bit().data() );
-  if( !ifs || !ifs.good() ) {
+  if( !::read_mdl_query_file( filename.toLocal8Bit().data() , mdl_queries_ ) ) {
     QMessageBox::warning( this , "MDL query file error" ,
                           QString( "Couldn't open %1 for reading.").arg( filename ) );
     return;
   }
 
-  int count = 0;
-  string next_line;
-  vector<string> next_query;
-  while( 1 ) {
-    getline( ifs , next_line );
-    if( ifs.eof() || !ifs.good() ) {
-      ++count;
-      store_next_mdl_query( next_query , filename , count );
-      break;
-    }
-    if( next_line == string( "$$$$") ) {
-      ++count;
-      store_next_mdl_query( next_query , filename , count );
-      next_query.clear();
-    } else {
-      next_query.push_back( next_line );
-    }
-
-  }
-
   update_status_count();
 
 }
@@ -908,9 +1455,9 @@ void SmiV::read_data_file( const QString &filename ) {
 
   data_table_->read_data_from_file( this , filename );
 
-  statusBar()->showMessage( QString( "Read %1 lines of data." ).arg( data_table_->rowCount() ) , 2000 );
+  statusBar()->showMessage( QString( "Read %1 lines of data." ).arg( data_table_->num_file_rows() ) , 2000 );
 
-  data_table_view_->show();
+  data_table_wid_->show();
 
 }
 
@@ -1057,17 +1604,42 @@ void SmiV::do_substructure_matching( vector<pair<boost::shared_ptr<OESubSearch>,
 
   vector<pSmiVRec> ones_to_do = left_panel_->smiv_recs();
 
+  // if the hits are kept, the panels just colour the atoms with them, rather
+  // than searching every molecule again as it's displayed.
+  bool keep_hits = smarts_keep_hits_->isChecked();
+  int hits_key = keep_hits ? SmiVRecord::new_hits_key() : 0;
+  pSmiVHitLabels hit_label_table;
+  if( keep_hits ) {
+    hit_label_table.reset( new SmiVHitLabels );
+  }
+
   QApplication::setOverrideCursor( Qt::WaitCursor );
   vector<pSmiVRec> left_list , right_list;
+  vector<unsigned int> hit_counts;
+  vector<string> hit_labels;
   for( int i = 0 , is = ones_to_do.size() ; i < is ; ++i ) {
     scoped_ptr<OEMolBase> mol( OENewMolBase( OEMolBaseType::OEDefault ) );
     OEParseSmiles( *mol ,  ones_to_do[i]->in_smi() );
     DACLIB::apply_daylight_aromatic_model( *mol );
     bool match_found( false );
-    for( int j = 0 , js = sub_searches.size() ; j < js ; ++j ) {
-      if( sub_searches[j].first->SingleMatch( *mol ) ) {
-        match_found = true;
-        break;
+    if( keep_hits ) {
+      // same atom indices as the molecule made for display from in_smi()
+      DACLIB::create_atom_indices( *mol );
+      DACLIB::count_subsearch_hits( *mol , sub_searches , hit_counts , hit_labels );
+      for( int j = 0 , js = hit_counts.size() ; j < js && !match_found ; ++j ) {
+        match_found = hit_counts[j] > 0;
+      }
+      if( match_found ) {
+        ones_to_do[i]->set_hits( hits_key , hit_counts , hit_labels , hit_label_table );
+      } else {
+        ones_to_do[i]->clear_hits();
+      }
+    } else {
+      for( int j = 0 , js = sub_searches.size() ; j < js ; ++j ) {
+        if( sub_searches[j].first->SingleMatch( *mol ) ) {
+          match_found = true;
+          break;
+        }
       }
     }
     if( match_found ) {
@@ -1079,7 +1651,7 @@ void SmiV::do_substructure_matching( vector<pair<boost::shared_ptr<OESubSearch>,
   QApplication::restoreOverrideCursor();
 
   left_panel_->add_data( left_list );
-  left_panel_->set_subsearches( sub_searches );
+  left_panel_->set_subsearches( sub_searches , hits_key );
   QString title = "Matched : " + list_name;
   left_panel_->set_title( title );
 
@@ -1160,16 +1732,7 @@ void SmiV::build_sub_searches_from_mdl_queries( const vector<char> &sel_mdl_quer
       mdl_list += QString( "|%1" ).arg( mdl_queries_[i].first.c_str() );
     }
 
-    oemolistream ims;
-    ims.openstring( mdl_queries_[i].second );
-    unsigned int aromodel = OEIFlavor::Generic::OEAroModelDaylight;
-    unsigned int qflavor  = ims.GetFlavor( OEFormat::MDL );
-    ims.SetFlavor( OEFormat::MDL , qflavor|aromodel );
-
-    OEQMol qmol;
-    OEReadMDLQueryFile( ims , qmol , OEMDLQueryOpts::Default );
-
-    OESubSearch *subs = new OESubSearch( qmol );
+    OESubSearch *subs = create_mdl_subsearch( mdl_queries_[i].second );
     sub_searches.push_back( make_pair( boost::shared_ptr<OESubSearch>( subs ) ,
                                        mdl_queries_[i].first ) );
   }
@@ -1238,33 +1801,6 @@ void SmiV::add_smarts_definition( QTSmartsEditDialog &sed ) {
 
 }
 
-// ****************************************************************************
-void SmiV::store_next_mdl_query( const vector<string>  &next_query ,
-                                 const QString &filename , int count ) {
-
-  // the query needs a little TLC, as if it has R Groups in it, it may have
-  // extraneous guff that OEChem doesn't seem to deal with
-  // first, strip out everything that starts with a $. Then, as soon as
-  // we hit M  END, stop as we don't want anything after that.
-  string query_string;
-  BOOST_FOREACH( string next_line , next_query ) {
-    if( '$' != next_line[0] ) {
-      query_string += next_line + '\n';
-    }
-    if( string( "M  END") == next_line.substr( 0 , 6 ) ) {
-      cout << "breaking on M  END" << endl;
-      break;
-    }
-
-  }
-
-  QString short_name( filename.section( "/" , -1 ) );
-  string query_name = string( short_name.toLocal8Bit().data() ) + "_" +
-                      lexical_cast<string>( count );
-  mdl_queries_.push_back( make_pair( query_name , query_string ) );
-
-}
-
 // ****************************************************************************
 // sees if the SMARTS name is already used. If it does, see what the user
 // wants to do about it - returns true if user wants to leave it as it is,
@@ -1365,6 +1901,7 @@ void SmiV::update_smiv_recs( const string &new_smiles , const string &new_name )
   } else {
     smiv_recs_.push_back( new_rec );
   }
+  smiv_recs_changed();
 
   if( right_panel_->isHidden() ) {
     left_panel_->add_data( smiv_recs_);
@@ -1419,6 +1956,141 @@ void SmiV::new_mol_list( QString list_name ) {
 
 }
 
+// ****************************************************************************
+// fingerprints_, if they're not there already. Returns false if the user
+// cancelled making them.
+bool SmiV::make_fingerprints() {
+
+  if( !fingerprints_ ) {
+    fingerprints_.reset( new SmiVFingerprints );
+    if( !fingerprints_->make( smiv_recs_ , this ) ) {
+      fingerprints_.reset();
+      return false;
+    }
+  }
+  return true;
+
+}
+
+// ****************************************************************************
+// The fingerprints of recs, usually the active panel's, copied from
+// fingerprints_ rather than made again. Any that aren't in smiv_recs_ mean
+// they all have to be made. Returns false if the user cancelled.
+bool SmiV::fingerprints_for( const vector<pSmiVRec> &recs , SmiVFingerprints &fps ) {
+
+  if( !make_fingerprints() ) {
+    return false;
+  }
+
+  QHash<const SmiVRecord *,int> rec_positions;
+  for( int i = 0 , is = smiv_recs_.size() ; i < is ; ++i ) {
+    rec_positions.insert( smiv_recs_[i].get() , i );
+  }
+  vector<int> positions;
+  positions.reserve( recs.size() );
+  for( int i = 0 , is = recs.size() ; i < is ; ++i ) {
+    QHash<const SmiVRecord *,int>::const_iterator p = rec_positions.find( recs[i].get() );
+    if( p == rec_positions.end() ) {
+      return fps.make( recs , this );
+    }
+    positions.push_back( p.value() );
+  }
+
+  fps.make_subset( *fingerprints_ , positions );
+  return true;
+
+}
+
+// ****************************************************************************
+void SmiV::smiv_recs_changed() {
+
+  smiles_index_.reset();
+  fingerprints_.reset();
+
+}
+
+// ****************************************************************************
+void SmiV::set_mol_list( const string &list_name , const vector<pSmiVRec> &recs ,
+                         bool show_list ) {
+
+  vector<pair<string,vector<pSmiVRec> > >::iterator p =
+      find_if( rec_lists_.begin() , rec_lists_.end() ,
+               bind( equal_to<string>() ,
+                     bind( &pair<string,vector<pSmiVRec> >::first , _1 ) ,
+                     list_name ) );
+  if( p == rec_lists_.end() ) {
+    add_mol_list( list_name , recs );
+  } else {
+    p->second = recs;
+  }
+  if( show_list ) {
+    show_mol_list( QString( list_name.c_str() ) );
+  }
+
+}
+
+// ****************************************************************************
+// This is on the text of the SMILES as read in, so it's quick but doesn't
+// know anything about the chemistry - C will find Cl, for example.
+void SmiV::find_smiles_text( bool use_regex ) {
+
+  if( smiv_recs_.empty() ) {
+    QMessageBox::information( this , "Find SMILES" , "No molecules to search." );
+    return;
+  }
+
+  bool ok;
+  QString search = QInputDialog::getText( this , use_regex ? "Find SMILES Regex" : "Find SMILES Text" ,
+                                          use_regex ? "Regular expression to look for in the SMILES :" :
+                                                      "Text to look for in the SMILES :" ,
+                                          QLineEdit::Normal , last_smiles_search_ , &ok );
+  if( !ok || search.isEmpty() ) {
+    return;
+  }
+  last_smiles_search_ = search;
+
+  if( !smiles_index_ ) {
+    statusBar()->showMessage( "Indexing SMILES..." );
+    QApplication::setOverrideCursor( Qt::WaitCursor );
+    vector<string> smiles;
+    smiles.reserve( smiv_recs_.size() );
+    for( int i = 0 , is = smiv_recs_.size() ; i < is ; ++i ) {
+      smiles.push_back( smiv_recs_[i]->in_smi() );
+    }
+    smiles_index_.reset( new SmiVTextIndex );
+    smiles_index_->set_texts( smiles );
+    QApplication::restoreOverrideCursor();
+    statusBar()->clearMessage();
+  }
+
+  vector<int> hits;
+  string search_str( search.toLocal8Bit().data() );
+  if( use_regex ) {
+    try {
+      smiles_index_->find_all_regex( search_str , hits );
+    } catch( boost::regex_error &e ) {
+      QMessageBox::warning( this , "Bad Regular Expression" ,
+                            QString( "%1 isn't a valid regular expression : %2" ).arg( search ).arg( e.what() ) );
+      return;
+    }
+  } else {
+    smiles_index_->find_all( search_str , hits );
+  }
+
+  statusBar()->showMessage( QString( "%1 molecules matched." ).arg( hits.size() ) , 5000 );
+  if( hits.empty() ) {
+    return;
+  }
+
+  vector<pSmiVRec> hit_recs;
+  hit_recs.reserve( hits.size() );
+  for( int i = 0 , is = hits.size() ; i < is ; ++i ) {
+    hit_recs.push_back( smiv_recs_[hits[i]] );
+  }
+  set_mol_list( ( use_regex ? "SMILES Regex : " : "SMILES Text : " ) + search_str , hit_recs );
+
+}
+
 // ****************************************************************************
 // for the special case when the data file that has been read into the table contained the columns
 // CoreSmiles and CoreSmarts - extract the SMILES/SMARTS strings into the relevant lists
@@ -1446,6 +2118,7 @@ void SmiV::build_core_smiles_list() {
     smiv_recs_.push_back( pSmiVRec( smiv_rec ) );
     p->second.push_back( smiv_recs_.back() );
   }
+  smiv_recs_changed();
 
 }
 
@@ -1458,9 +2131,17 @@ void SmiV::build_core_smarts_list() {
     return;
   }
 
-  for( int i = 0 , is = data_table_->rowCount() ; i < is ; ++i ) {
-    add_smarts_definition( data_table_->data( i , 0 ).toString() ,
-                           data_table_->data( i , smarts_col ).toString() );
+  // in file order, so it's the same whatever sorting or filtering there is
+  if( !data_table_->fetch_all() ) {
+    return;
+  }
+  const SmivDataColumn &name_col = data_table_->column( 0 );
+  const SmivDataColumn &smarts_vals = data_table_->column( smarts_col );
+  for( int i = 0 , is = data_table_->num_file_rows() ; i < is ; ++i ) {
+    if( !smarts_vals.is_null( i ) ) {
+      add_smarts_definition( name_col.value( i ).toString() ,
+                             smarts_vals.value( i ).toString() );
+    }
   }
 
 }
@@ -1501,123 +2182,54 @@ void SmiV::search_with_core_smarts( int smarts_num ) {
 }
 
 // ****************************************************************************
-// for all the CoreSmarts column in the data_table_, run against the full molecule list and
-// calculate the number of R Group subst points round each core that are used, and the number
-// of unique R Groups, feeding the results back into the columns RgroupPositions and
-// NumberOfUniqueRgroups
-void SmiV::do_rgroup_analysis_of_core_smarts() {
+bool SmiV::find_core_smarts() {
 
-  vector<char> smarts_to_use( smarts_.size() , 1 );
-  vector<pair<boost::shared_ptr<OESubSearch>,string> > sub_searches;
-  QString smarts_list;
-  build_sub_searches_from_smarts( smarts_to_use , smarts_list , sub_searches );
-  vector<set<int> > rgroup_pos( smarts_.size() , set<int>() );
-  vector<set<string> > unique_rgroups( smarts_.size() , set<string>() );
-  vector<int> core_counts( smarts_.size() , 0 );
-
-  BOOST_FOREACH( pSmiVRec rec , smiv_recs_ ) {
-#ifdef NOTYET
-      cout << "doing molecule " << rec->smi_name() << " : " << rec->in_smi() << endl;
-#endif
-      OEGraphMol mol;
-      OEParseSmiles( mol , rec->in_smi() );
-      bool core_mol( rec->smi_name().substr( 0 , 4 ) == string( "core" ) );
-      for( int i = 0 , is = sub_searches.size() ; i < is ; ++i ) {
-#ifdef NOTYET
-        cout << "doing smarts " << i << " : " << sub_searches[i].second << " : " << smarts_[i].first << " : " << smarts_[i].second << endl;
-#endif
-        if( sub_searches[i].second.substr( 0 , 4 ) == string( "core" ) ) {
-          if( core_mol ) {
-            rgroup_core_count( mol , sub_searches[i].first , core_counts[i] );
-          } else {
-            rgroup_counts_and_strip( mol , sub_searches[i].first , rgroup_pos[i] , unique_rgroups[i] );
-          }
-        }
-      }
-  }
-
-  update_rgroup_position_counts( rgroup_pos , unique_rgroups , core_counts );
-
-}
-
-// ****************************************************************************
-
-void SmiV::rgroup_counts_and_strip( OEGraphMol &mol , boost::shared_ptr<OESubSearch> &sub ,
-                                    set<int> &rgroup_pos , set<string> &unique_rgroups ) {
-
-  // just want the first match, I think.  Symmetry issues aren't of interest.
-  OEIter<OEMatchBase> match = sub->Match( mol , true );
-  if( !match ) {
-    return;
+  for( int i = 0 , is = smarts_.size() ; i < is ; ++i ) {
+    if( smarts_[i].first.substr( 0 , 4 ) == string( "core" ) ) {
+      return true;
+    }
   }
-  vector<unsigned int> in_core( DACLIB::max_atom_index( mol ) , 0 );
-  for( OEIter<OEAtomBase> atom = match->GetTargetAtoms() ; atom ; ++atom ) {
-    in_core[DACLIB::atom_index( *atom )] = 1;
+  if( -1 == get_data_table_column_number( QString( "CoreSmarts" ) ) ) {
+    return false;
   }
-  int i = 0;
-  for( OEIter<OEAtomBase> atom = match->GetTargetAtoms() ; atom ; ++atom , ++i ) {
-    for( OEIter<OEAtomBase> conn = atom->GetAtoms() ; conn ; ++conn ) {
-      if( !in_core[DACLIB::atom_index( *conn )] ) {
-        rgroup_pos.insert( i );
-        unique_rgroups.insert( generate_rgroup_smiles( mol , conn , in_core ) );
-      }
+  build_core_smarts_list();
+  for( int i = 0 , is = smarts_.size() ; i < is ; ++i ) {
+    if( smarts_[i].first.substr( 0 , 4 ) == string( "core" ) ) {
+      return true;
     }
   }
 
+  return false;
+
 }
 
 // ****************************************************************************
-string SmiV::generate_rgroup_smiles( OEGraphMol &mol , OEAtomBase &first_atom ,
-                                     const vector<unsigned int> &in_core ) {
-
-  string rgroup_smi;
+// for all the CoreSmarts column in the data_table_, run against the full molecule list and
+// calculate the number of R Group subst points round each core that are used, and the number
+// of unique R Groups, feeding the results back into the columns RgroupPositions and
+// NumberOfUniqueRgroups
+void SmiV::do_rgroup_analysis_of_core_smarts() {
 
-  OEGraphMol mol_copy( mol );
-  vector<unsigned int> ats_to_keep( DACLIB::max_atom_index( mol_copy ) , 0 );
-  list<OEAtomBase *> to_do( 1 , &first_atom );
-  vector<unsigned int> done_atoms( in_core );
-  while( !to_do.empty() ) {
-    OEAtomBase *next_at = to_do.front();
-    done_atoms[DACLIB::atom_index( *next_at )] = 1;
-    to_do.pop_front();
-    ats_to_keep[DACLIB::atom_index( *next_at )] = 1;
-    for( OEIter<OEAtomBase> conn_ats = next_at->GetAtoms() ; conn_ats ; ++conn_ats ) {
-      if( !done_atoms[DACLIB::atom_index( *conn_ats )] ) {
-        to_do.push_back( conn_ats );
-      }
-    }
+  // only the cores are any use, so don't bother making searches for the rest
+  vector<char> smarts_to_use( smarts_.size() , 0 );
+  for( int i = 0 , is = smarts_.size() ; i < is ; ++i ) {
+    smarts_to_use[i] = smarts_[i].first.substr( 0 , 4 ) == string( "core" );
   }
+  vector<pair<boost::shared_ptr<OESubSearch>,string> > sub_searches;
+  QString smarts_list;
+  build_sub_searches_from_smarts( smarts_to_use , smarts_list , sub_searches );
 
-  for( OEIter<OEAtomBase> atom = mol_copy.GetAtoms() ; atom ; ++atom ) {
-    // if the atom going is attached to a keep atom, then put something on to show this.
-    // if the keep atom is the first atom, then put attach an Xe, otherwise attach
-    // a Y.
-    if( !ats_to_keep[DACLIB::atom_index( *atom )] ) {
-      for( OEIter<OEAtomBase> conn_at = atom->GetAtoms() ; conn_at ; ++conn_at ) {
-        if( ats_to_keep[DACLIB::atom_index( *conn_at )] ) {
-          unsigned int tag_atom = OEElemNo::H;
-          if( DACLIB::atom_index( *conn_at ) == DACLIB::atom_index( first_atom ) ) {
-            tag_atom = OEElemNo::Xe;
-          } else {
-            tag_atom = OEElemNo::Y;
-          }
-          OEAtomBase *new_at = mol_copy.NewAtom( tag_atom );
-          mol_copy.NewBond( new_at , conn_at , mol_copy.GetBond( atom , conn_at )->GetOrder() );
-        }
-      }
-      mol_copy.DeleteAtom( atom );
-    }
+  SmiVRgroupAnalyser analyser( sub_searches );
+  if( !analyser.analyse( smiv_recs_ , this ) ) {
+    return;
   }
-  OECreateCanSmiString( rgroup_smi , mol_copy );
 
-  return rgroup_smi;
+  update_rgroup_position_counts( analyser );
 
 }
 
 // ****************************************************************************
-void SmiV::update_rgroup_position_counts( const vector<set<int> > &rgroup_pos ,
-                                          const vector<set<string> > &unique_rgroups ,
-                                          const vector<int> &core_counts ) {
+void SmiV::update_rgroup_position_counts( const SmiVRgroupAnalyser &analyser ) {
 
   int pos_count_col = get_data_table_column_number( "RgroupPositions" );
   if( -1 == pos_count_col ) {
@@ -1634,24 +2246,25 @@ void SmiV::update_rgroup_position_counts( const vector<set<int> > &rgroup_pos ,
     QMessageBox::warning( this , "No column" , "No column named CoreContainedIn for R Group counts, so skipping." );
     return;
   }
-
-  for( int i = 0 , is = rgroup_pos.size() ; i < is ; ++i ) {
-    if( rgroup_pos[i].size() ) {
-      data_table_->change_data( i , pos_count_col , QVariant( static_cast<int>( rgroup_pos[i].size() ) ) );
-      data_table_->change_data( i , uniq_count_col , QVariant( static_cast<int>( unique_rgroups[i].size() ) ) );
-      data_table_->change_data( i , core_count_col , QVariant( core_counts[i] ) );
-    }
+  if( !data_table_->fetch_all() ) {
+    return;
   }
 
-}
-
-// ****************************************************************************
-// when molecule and subsearch are both cores, count whether mol contains sub
-void SmiV::rgroup_core_count( OEChem::OEGraphMol &mol , boost::shared_ptr<OESubSearch> &sub ,
-                              int &core_count ) {
+  // change_data wants rows in file order, and the cores might not be in the
+  // same order as the table, so go by name, which is in the first column.
+  QHash<QString,int> core_rows;
+  const SmivDataColumn &name_col = data_table_->column( 0 );
+  for( int i = data_table_->num_file_rows() - 1 ; i >= 0 ; --i ) {
+    core_rows.insert( name_col.value( i ).toString() , i );
+  }
 
-  if( sub->SingleMatch( mol ) ) {
-    ++core_count;
+  for( int i = 0 , is = analyser.num_cores() ; i < is ; ++i ) {
+    QHash<QString,int>::const_iterator p = core_rows.constFind( QString( analyser.core_name( i ).c_str() ) );
+    if( p != core_rows.constEnd() && analyser.rgroup_positions( i ).size() ) {
+      data_table_->change_data( p.value() , pos_count_col , QVariant( static_cast<int>( analyser.rgroup_positions( i ).size() ) ) );
+      data_table_->change_data( p.value() , uniq_count_col , QVariant( static_cast<int>( analyser.unique_rgroups( i ).size() ) ) );
+      data_table_->change_data( p.value() , core_count_col , QVariant( analyser.core_count( i ) ) );
+    }
   }
 
 }
@@ -0,0 +1,147 @@
+//
+// file SmiVBatchExport.cc
+//
+
+#include "SmiVBatchExport.H"
+#include "SmiVDepictionExport.H"
+#include "SmiVMolFiles.H"
+#include "SmiVRecord.H"
+#include "SmiVSettings.H"
+
+#include "SMARTSExceptions.H"
+
+#include <QDir>
+#include <QString>
+
+#include <oechem.h>
+
+#include <iostream>
+
+#include <boost/scoped_ptr.hpp>
+
+using namespace boost;
+using namespace std;
+using namespace OEChem;
+using namespace OESystem;
+
+namespace DACLIB {
+  void apply_daylight_aromatic_model( OEMolBase &mol );
+  void read_smarts_file( const string &smarts_file ,
+                         vector<pair<string,string> > &input_smarts ,
+                         vector<pair<string,string> > &smarts_sub_defn );
+  OESubSearch *create_eosubsearch( const string &smarts ,
+                                   const string &smarts_name ,
+                                   bool reorder ,
+                                   vector<pair<string,string> > &sub_defns );
+}
+
+namespace {
+
+// ****************************************************************************
+// all the SMARTS and MDL queries from the files in ss. Returns false, having
+// said why, if any of them can't be read.
+bool build_sub_searches( SmiVSettings &ss , SmiVSubSearches &sub_searches ) {
+
+  if( !ss.smarts_file().empty() ) {
+    vector<pair<string,string> > smarts , smarts_sub_defn;
+    try {
+      DACLIB::read_smarts_file( ss.smarts_file() , smarts , smarts_sub_defn );
+      for( int i = 0 , is = smarts.size() ; i < is ; ++i ) {
+        OESubSearch *subs = DACLIB::create_eosubsearch( smarts[i].second , smarts[i].first ,
+                                                        false , smarts_sub_defn );
+        sub_searches.push_back( make_pair( boost::shared_ptr<OESubSearch>( subs ) ,
+                                           smarts[i].first ) );
+      }
+    } catch( DACLIB::SMARTSSubDefnError &e ) {
+      cerr << e.what() << endl;
+      return false;
+    } catch( DACLIB::SMARTSDefnError &e ) {
+      cerr << e.what() << endl;
+      return false;
+    } catch( DACLIB::SMARTSFileError &e ) {
+      cerr << e.what() << endl;
+      return false;
+    }
+  }
+
+  if( !ss.mdl_file().empty() ) {
+    vector<pair<string,string> > mdl_queries;
+    if( !read_mdl_query_file( ss.mdl_file() , mdl_queries ) ) {
+      cerr << "Couldn't open " << ss.mdl_file() << " for reading." << endl;
+      return false;
+    }
+    for( int i = 0 , is = mdl_queries.size() ; i < is ; ++i ) {
+      sub_searches.push_back( make_pair( boost::shared_ptr<OESubSearch>( create_mdl_subsearch( mdl_queries[i].second ) ) ,
+                                         mdl_queries[i].first ) );
+    }
+  }
+
+  return true;
+
+}
+
+// ****************************************************************************
+void keep_matching_recs( const SmiVSubSearches &sub_searches ,
+                         vector<pSmiVRec> &recs ) {
+
+  vector<pSmiVRec> matched;
+  for( int i = 0 , is = recs.size() ; i < is ; ++i ) {
+    scoped_ptr<OEMolBase> mol( OENewMolBase( OEMolBaseType::OEDefault ) );
+    OEParseSmiles( *mol , recs[i]->in_smi() );
+    DACLIB::apply_daylight_aromatic_model( *mol );
+    for( int j = 0 , js = sub_searches.size() ; j < js ; ++j ) {
+      if( sub_searches[j].first->SingleMatch( *mol ) ) {
+        matched.push_back( recs[i] );
+        break;
+      }
+    }
+  }
+  recs.swap( matched );
+
+}
+
+} // EO anon namespace
+
+// ****************************************************************************
+int smiv_batch_export( SmiVSettings &ss ) {
+
+  if( ss.mol_file().empty() ) {
+    cerr << "No molecule file to export from." << endl;
+    ss.print_usage( cerr );
+    return 1;
+  }
+  if( !SmiVDepictionExport::can_write_format( ss.export_format() ) ) {
+    cerr << "Can't write pictures in format " << ss.export_format() << "." << endl;
+    return 1;
+  }
+
+  vector<pSmiVRec> recs;
+  read_mol_file( ss.mol_file() , recs );
+  if( recs.empty() ) {
+    cerr << "No molecules read from " << ss.mol_file() << "." << endl;
+    return 1;
+  }
+
+  // with queries, it's just the ones that match, highlighted.
+  SmiVSubSearches sub_searches;
+  if( !build_sub_searches( ss , sub_searches ) ) {
+    return 1;
+  }
+  if( !sub_searches.empty() ) {
+    keep_matching_recs( sub_searches , recs );
+  }
+
+  if( !QDir().mkpath( QString( ss.export_dir().c_str() ) ) ) {
+    cerr << "Couldn't make directory " << ss.export_dir() << "." << endl;
+    return 1;
+  }
+
+  SmiVDepictionExport exp( recs , sub_searches , 0 );
+  exp.set_mol_size( ss.export_width() , ss.export_height() );
+  exp.set_grid( ss.export_grid_rows() , ss.export_grid_cols() );
+  int num_written = exp.write( ss.export_dir() , ss.export_format() );
+  cout << "Wrote " << num_written << " files to " << ss.export_dir() << "." << endl;
+
+  return 0;
+
+}
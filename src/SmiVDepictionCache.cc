@@ -0,0 +1,405 @@
+//
+// file SmiVDepictionCache.cc
+//
+
+#include "SmiVDepictionCache.H"
+#include "SmiVRecord.H"
+
+#include "DACOEMolAtomIndex.H"
+#include "QTMolDisplay2D.H"
+
+#include <QMetaObject>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThread>
+
+#include <oechem.h>
+#include <oedepict.h>
+
+#include <algorithm>
+
+using namespace std;
+using namespace OEChem;
+using namespace OEDepict;
+using namespace OESystem;
+
+namespace DACLIB {
+// in eponymous file
+void count_subsearch_hits( OEMolBase &mol ,
+                           const vector<pair<boost::shared_ptr<OESubSearch>,string> > &sub_searches ,
+                           vector<unsigned int> &hit_counts ,
+                           vector<string> &hit_labels );
+// in draw_oemol_to_qimage.cc
+pair<QImage *,OE2DMolDisplay *> draw_oemol_to_qimage( int width , int height , OEMolBase &mol ,
+                                                      bool coloured_mol ,
+                                                      const vector<pair<OEAtomBase * , string> > &atom_labels ,
+                                                      const vector<pair<OEAtomBase * , QColor> > &atom_colours ,
+                                                      const vector<pair<OEBondBase * , QColor> > &bond_colours );
+}
+
+static const int MIN_PREFETCH_DEPTH = 2;
+static const int MAX_PREFETCH_DEPTH = 10;
+
+// ****************************************************************************
+// Renders a single molecule in one of the SmiVDepictionCache's threads. The
+// things it needs from the record are copied in the GUI thread when the job
+// is made, so it doesn't touch the record at all. The sub-searches come from
+// the cache when the job runs, so none are copied here.
+class SmiVRenderJob : public QRunnable {
+
+public :
+
+  SmiVRenderJob( SmiVDepictionCache *cache , const pSmiVDepiction &dep ,
+                 bool have_searches , int hits_key , int searches_generation ) :
+    cache_( cache ) , dep_( dep ) , smiles_( dep->rec_->in_smi() ) ,
+    name_( dep->rec_->smi_name() ) , coords_2d_( dep->rec_->coords_2d() ) ,
+    use_searches_( have_searches ) , searches_generation_( searches_generation ) {
+
+    // if the matching kept the hits, there's no need for the searches
+    if( have_searches && dep->rec_->has_hits( hits_key ) ) {
+      dep->rec_->get_hits( dep->hit_counts_ , dep->hit_labels_ );
+      dep->supplied_hits_ = true;
+      use_searches_ = false;
+    }
+
+  }
+
+  void run() {
+
+    // the user may have moved on since this job was queued
+    if( !cache_->still_wanted( *dep_ ) ) {
+      cache_->job_finished( dep_ , false );
+      return;
+    }
+
+    SmiVSubSearches sub_searches;
+    if( use_searches_ ) {
+      sub_searches = cache_->take_sub_searches( searches_generation_ );
+    }
+    SmiVDepictionCache::render_depiction( *dep_ , smiles_ , name_ , coords_2d_ ,
+                                          sub_searches );
+    if( use_searches_ ) {
+      cache_->give_back_sub_searches( searches_generation_ , sub_searches );
+    }
+    cache_->job_finished( dep_ , true );
+
+  }
+
+private :
+
+  SmiVDepictionCache *cache_;
+  pSmiVDepiction dep_;
+  string smiles_ , name_;
+  vector<float> coords_2d_;
+  bool use_searches_;
+  int searches_generation_;
+
+};
+
+// ****************************************************************************
+SmiVDepictionCache::SmiVDepictionCache( QObject *parent ) :
+  QObject( parent ) , generation_( 0 ) , prefetch_depth_( MIN_PREFETCH_DEPTH ) ,
+  hits_key_( 0 ) , job_generation_( 0 ) , searches_generation_( 0 ) {
+
+  // leave a core for the GUI thread
+  pool_.setMaxThreadCount( max( 1 , QThread::idealThreadCount() - 1 ) );
+  nav_timer_.start();
+
+}
+
+// ****************************************************************************
+SmiVDepictionCache::~SmiVDepictionCache() {
+
+  // anything that hasn't started yet will see that it's not wanted and
+  // finish straightaway.
+  {
+    QMutexLocker lock( &mutex_ );
+    ++job_generation_;
+    wanted_.clear();
+  }
+  pool_.waitForDone();
+
+}
+
+// ****************************************************************************
+pSmiVDepiction SmiVDepictionCache::depiction( const pSmiVRec &rec , const QSize &size ,
+                                              bool coloured_mol ) const {
+
+  map<const SmiVRecord *,pSmiVDepiction>::const_iterator p = cache_.find( rec.get() );
+  if( p == cache_.end() || p->second->size_ != size ||
+      p->second->coloured_mol_ != coloured_mol ||
+      p->second->generation_ != generation_ ) {
+    return pSmiVDepiction();
+  }
+
+  return p->second;
+
+}
+
+// ****************************************************************************
+void SmiVDepictionCache::prefetch( const vector<pSmiVRec> &recs , int curr_rec ,
+                                   const QSize &size , bool coloured_mol ,
+                                   const SmiVSubSearches &sub_searches ) {
+
+  update_prefetch_depth();
+
+  if( recs.empty() || curr_rec < 0 || curr_rec >= int( recs.size() ) ) {
+    return;
+  }
+
+  // nearest ones first, so they get the highest priority.
+  vector<pSmiVRec> wanted( 1 , recs[curr_rec] );
+  for( int i = 1 ; i <= prefetch_depth_ ; ++i ) {
+    if( curr_rec + i < int( recs.size() ) ) {
+      wanted.push_back( recs[curr_rec + i] );
+    }
+    if( curr_rec - i >= 0 ) {
+      wanted.push_back( recs[curr_rec - i] );
+    }
+  }
+
+  request( wanted , size , coloured_mol , sub_searches );
+
+}
+
+// ****************************************************************************
+void SmiVDepictionCache::request( const vector<pSmiVRec> &recs , const QSize &size ,
+                                  bool coloured_mol , const SmiVSubSearches &sub_searches ,
+                                  int num_to_skip ) {
+
+  set_sub_searches( sub_searches );
+
+  set<const SmiVRecord *> wanted;
+  for( int i = 0 , is = recs.size() ; i < is ; ++i ) {
+    wanted.insert( recs[i].get() );
+  }
+
+  // forget the ones that have dropped out of the window
+  for( map<const SmiVRecord *,pSmiVDepiction>::iterator p = cache_.begin() ; p != cache_.end() ; ) {
+    if( wanted.count( p->first ) ) {
+      ++p;
+    } else {
+      cache_.erase( p++ );
+    }
+  }
+
+  {
+    QMutexLocker lock( &mutex_ );
+    wanted_.swap( wanted );
+  }
+
+  for( int i = num_to_skip , is = recs.size() ; i < is ; ++i ) {
+    if( depiction( recs[i] , size , coloured_mol ) ||
+        pending_.count( PendingKey( recs[i].get() , generation_ , size , coloured_mol ) ) ) {
+      continue;
+    }
+    submit_job( recs[i] , size , coloured_mol , is - i );
+  }
+
+}
+
+// ****************************************************************************
+void SmiVDepictionCache::clear() {
+
+  ++generation_;
+  cache_.clear();
+
+  QMutexLocker lock( &mutex_ );
+  job_generation_ = generation_;
+  wanted_.clear();
+
+}
+
+// ****************************************************************************
+bool SmiVDepictionCache::still_wanted( const SmiVDepiction &dep ) {
+
+  QMutexLocker lock( &mutex_ );
+  return dep.generation_ == job_generation_ && wanted_.count( dep.rec_.get() );
+
+}
+
+// ****************************************************************************
+void SmiVDepictionCache::job_finished( const pSmiVDepiction &dep , bool rendered ) {
+
+  {
+    QMutexLocker lock( &mutex_ );
+    finished_.push_back( make_pair( dep , rendered ) );
+  }
+
+  QMetaObject::invokeMethod( this , "slot_process_finished_jobs" , Qt::QueuedConnection );
+
+}
+
+// ****************************************************************************
+// Copying job_searches_ is safe with the lock held, as nothing else uses it.
+// If the sub-searches have changed since the job was queued, its picture
+// will be thrown away, so it doesn't matter which it gets.
+SmiVSubSearches SmiVDepictionCache::take_sub_searches( int searches_generation ) {
+
+  QMutexLocker lock( &mutex_ );
+  if( searches_generation != searches_generation_ || spare_searches_.empty() ) {
+    return copy_sub_searches( job_searches_ );
+  }
+
+  SmiVSubSearches sub_searches;
+  sub_searches.swap( spare_searches_.back() );
+  spare_searches_.pop_back();
+  return sub_searches;
+
+}
+
+// ****************************************************************************
+void SmiVDepictionCache::give_back_sub_searches( int searches_generation ,
+                                                 SmiVSubSearches &sub_searches ) {
+
+  QMutexLocker lock( &mutex_ );
+  if( searches_generation == searches_generation_ ) {
+    spare_searches_.push_back( SmiVSubSearches() );
+    spare_searches_.back().swap( sub_searches );
+  }
+
+}
+
+// ****************************************************************************
+void SmiVDepictionCache::render_depiction( SmiVDepiction &dep , const string &smiles ,
+                                           const string &name ,
+                                           const vector<float> &coords_2d ,
+                                           const SmiVSubSearches &sub_searches ) {
+
+  dep.mol_.reset( OENewMolBase( OEMolBaseType::OEDefault ) );
+  OEMolBase &mol = *dep.mol_;
+  OEParseSmiles( mol , smiles );
+  SmiVRecord::apply_2d_coords( coords_2d , mol );
+  mol.SetTitle( name );
+
+  // as QTMolDisplay2D::set_display_molecule
+  OEPrepareDepiction( mol , 2 != mol.GetDimension() );
+  if( coords_2d.empty() ) {
+    SmiVRecord::get_2d_coords( mol , dep.coords_2d_ );
+  }
+
+  vector<pair<OEAtomBase * , QColor> > atom_colours;
+  if( !dep.supplied_hits_ && !sub_searches.empty() ) {
+    DACLIB::count_subsearch_hits( mol , sub_searches , dep.hit_counts_ , dep.hit_labels_ );
+  }
+  if( !dep.hit_counts_.empty() ) {
+    for( OEIter<OEAtomBase> atom = mol.GetAtoms() ; atom ; ++atom ) {
+      unsigned int at_ind = DACLIB::atom_index( *atom );
+      if( at_ind < dep.hit_counts_.size() && dep.hit_counts_[at_ind] ) {
+        atom_colours.push_back( make_pair( static_cast<OEAtomBase *>( atom ) ,
+                                           DACLIB::QTMolDisplay2D::hit_count_colour( dep.hit_counts_[at_ind] ) ) );
+      }
+    }
+  }
+
+  pair<QImage *,OE2DMolDisplay *> img_disp =
+      DACLIB::draw_oemol_to_qimage( dep.size_.width() , dep.size_.height() , mol ,
+                                    dep.coloured_mol_ ,
+                                    vector<pair<OEAtomBase * , string> >() ,
+                                    atom_colours ,
+                                    vector<pair<OEBondBase * , QColor> >() );
+  dep.image_ = *img_disp.first;
+  delete img_disp.first;
+  dep.disp_.reset( img_disp.second );
+
+}
+
+// ****************************************************************************
+bool SmiVDepictionCache::PendingKey::operator<( const PendingKey &rhs ) const {
+
+  if( rec_ != rhs.rec_ ) {
+    return rec_ < rhs.rec_;
+  }
+  if( generation_ != rhs.generation_ ) {
+    return generation_ < rhs.generation_;
+  }
+  if( width_ != rhs.width_ ) {
+    return width_ < rhs.width_;
+  }
+  if( height_ != rhs.height_ ) {
+    return height_ < rhs.height_;
+  }
+  return coloured_mol_ < rhs.coloured_mol_;
+
+}
+
+// ****************************************************************************
+// New sub-searches mean new colouring, so what's there already is no good.
+// They're copied once here, for the jobs to make their own copies from, as
+// the originals are also used in the GUI thread.
+void SmiVDepictionCache::set_sub_searches( const SmiVSubSearches &sub_searches ) {
+
+  if( sub_searches == source_searches_ ) {
+    return;
+  }
+
+  source_searches_ = sub_searches;
+  clear();
+
+  SmiVSubSearches job_searches = copy_sub_searches( sub_searches );
+  QMutexLocker lock( &mutex_ );
+  ++searches_generation_;
+  job_searches_.swap( job_searches );
+  spare_searches_.clear();
+
+}
+
+// ****************************************************************************
+void SmiVDepictionCache::submit_job( const pSmiVRec &rec , const QSize &size ,
+                                     bool coloured_mol , int priority ) {
+
+  pSmiVDepiction dep( new SmiVDepiction );
+  dep->rec_ = rec;
+  dep->size_ = size;
+  dep->coloured_mol_ = coloured_mol;
+  dep->generation_ = generation_;
+
+  pending_.insert( PendingKey( *dep ) );
+  pool_.start( new SmiVRenderJob( this , dep , !source_searches_.empty() , hits_key_ ,
+                                   searches_generation_ ) , priority );
+
+}
+
+// ****************************************************************************
+// the quicker the user is moving through the molecules, the further ahead
+// we need to be.
+void SmiVDepictionCache::update_prefetch_depth() {
+
+  qint64 since_last = nav_timer_.restart();
+  if( since_last < 300 ) {
+    prefetch_depth_ = min( prefetch_depth_ + 1 , MAX_PREFETCH_DEPTH );
+  } else if( since_last > 1000 ) {
+    prefetch_depth_ = max( prefetch_depth_ - 1 , MIN_PREFETCH_DEPTH );
+  }
+
+}
+
+// ****************************************************************************
+void SmiVDepictionCache::slot_process_finished_jobs() {
+
+  vector<pair<pSmiVDepiction,bool> > finished;
+  set<const SmiVRecord *> wanted;
+  {
+    QMutexLocker lock( &mutex_ );
+    finished.swap( finished_ );
+    wanted = wanted_;
+  }
+
+  for( int i = 0 , is = finished.size() ; i < is ; ++i ) {
+    pSmiVDepiction dep = finished[i].first;
+    pending_.erase( PendingKey( *dep ) );
+    if( !finished[i].second || dep->generation_ != generation_ ) {
+      continue;
+    }
+    // the layout is worth keeping even if the picture isn't
+    if( !dep->coords_2d_.empty() && !dep->rec_->has_2d_coords() ) {
+      dep->rec_->set_2d_coords( dep->coords_2d_ );
+    }
+    if( !wanted.count( dep->rec_.get() ) ) {
+      continue;
+    }
+    cache_[dep->rec_.get()] = dep;
+    emit depiction_ready( dep->rec_ );
+  }
+
+}
@@ -0,0 +1,243 @@
+//
+// file SmiVDepictionExport.cc
+//
+
+#include "SmiVDepictionExport.H"
+#include "SmiVRecord.H"
+
+#include "DACOEMolAtomIndex.H"
+#include "QTMolDisplay2D.H"
+#include "QTParallelFor.H"
+
+#include <QColor>
+#include <QString>
+
+#include <oechem.h>
+#include <oedepict.h>
+
+#include <cctype>
+
+#include <boost/scoped_ptr.hpp>
+
+using namespace boost;
+using namespace std;
+using namespace OEChem;
+using namespace OEDepict;
+using namespace OESystem;
+
+namespace DACLIB {
+// in eponymous file
+void count_subsearch_hits( OEMolBase &mol ,
+                           const vector<pair<boost::shared_ptr<OESubSearch>,string> > &sub_searches ,
+                           vector<unsigned int> &hit_counts ,
+                           vector<string> &hit_labels );
+// in draw_oemol_to_qimage.cc
+OE2DMolDisplay *create_oe_mol_display( int width , int height , OEMolBase &mol ,
+                                       bool coloured_mol ,
+                                       const vector<pair<OEAtomBase * , string> > &atom_labels ,
+                                       const vector<pair<OEAtomBase * , QColor> > &atom_colours ,
+                                       const vector<pair<OEBondBase * , QColor> > &bond_colours );
+}
+
+// ****************************************************************************
+// The function object for DACLIB::parallel_for. Each item is a file, either a
+// single molecule or a page of them. Each worker has its own copies of the
+// searches.
+class SmiVExportWorker {
+
+public :
+
+  SmiVExportWorker( const SmiVDepictionExport &exp , const string &out_dir ,
+                    const string &format ) :
+    exp_( exp ) , out_dir_( out_dir ) , format_( format ) ,
+    num_written_( DACLIB::num_parallel_workers() , 0 ) ,
+    sub_searches_( DACLIB::num_parallel_workers() ) {
+
+    for( int i = 0 , is = sub_searches_.size() ; i < is ; ++i ) {
+      sub_searches_[i] = copy_sub_searches( exp_.sub_searches_ );
+    }
+
+  }
+
+  int num_files() const {
+    if( !exp_.num_rows_ || !exp_.num_cols_ ) {
+      return exp_.mols_.size();
+    }
+    int page_size = exp_.num_rows_ * exp_.num_cols_;
+    return ( int( exp_.mols_.size() ) + page_size - 1 ) / page_size;
+  }
+
+  int num_written() const {
+    int tot = 0;
+    for( int i = 0 , is = num_written_.size() ; i < is ; ++i ) {
+      tot += num_written_[i];
+    }
+    return tot;
+  }
+
+  void operator()( int file_num , int worker_num ) {
+    bool ok = ( !exp_.num_rows_ || !exp_.num_cols_ ) ?
+          write_mol( file_num , worker_num ) : write_page( file_num , worker_num );
+    if( ok ) {
+      ++num_written_[worker_num];
+    }
+  }
+
+private :
+
+  const SmiVDepictionExport &exp_;
+  string out_dir_ , format_;
+  vector<int> num_written_; // by worker, so no locking needed
+  vector<SmiVSubSearches> sub_searches_;
+
+  // the molecule ready for create_oe_mol_display, and the colours for the hits
+  void prepare_mol( int mol_num , int worker_num , OEMolBase &mol ,
+                    vector<pair<OEAtomBase * , QColor> > &atom_colours ) {
+
+    const SmiVDepictionExport::ExportMol &em = exp_.mols_[mol_num];
+    OEParseSmiles( mol , em.smiles_ );
+    SmiVRecord::apply_2d_coords( em.coords_2d_ , mol );
+    mol.SetTitle( em.name_ );
+    OEPrepareDepiction( mol , 2 != mol.GetDimension() );
+
+    if( sub_searches_[worker_num].empty() ) {
+      return;
+    }
+
+    vector<unsigned int> hit_counts = em.hit_counts_;
+    vector<string> hit_labels;
+    if( hit_counts.empty() ) {
+      DACLIB::count_subsearch_hits( mol , sub_searches_[worker_num] , hit_counts , hit_labels );
+    }
+    for( OEIter<OEAtomBase> atom = mol.GetAtoms() ; atom ; ++atom ) {
+      unsigned int at_ind = DACLIB::atom_index( *atom );
+      if( at_ind < hit_counts.size() && hit_counts[at_ind] ) {
+        atom_colours.push_back( make_pair( static_cast<OEAtomBase *>( atom ) ,
+                                           DACLIB::QTMolDisplay2D::hit_count_colour( hit_counts[at_ind] ) ) );
+      }
+    }
+
+  }
+
+  // the sequence number is padded so the files sort in the same order as
+  // the molecules, and the name is unique even if the molecule names aren't.
+  string file_name( int num , const string &name ) const {
+    int num_digits = QString::number( num_files() ).length();
+    QString fn = QString( "%1/%2_%3.%4" ).arg( out_dir_.c_str() )
+        .arg( num , num_digits , 10 , QChar( '0' ) ).arg( name.c_str() )
+        .arg( format_.c_str() );
+    return fn.toLocal8Bit().data();
+  }
+
+  bool write_mol( int mol_num , int worker_num ) {
+
+    scoped_ptr<OEMolBase> mol( OENewMolBase( OEMolBaseType::OEDefault ) );
+    vector<pair<OEAtomBase * , QColor> > atom_colours;
+    prepare_mol( mol_num , worker_num , *mol , atom_colours );
+
+    scoped_ptr<OE2DMolDisplay> disp( DACLIB::create_oe_mol_display( exp_.width_ , exp_.height_ , *mol ,
+                                                                    sub_searches_[worker_num].empty() ,
+                                                                    vector<pair<OEAtomBase * , string> >() ,
+                                                                    atom_colours ,
+                                                                    vector<pair<OEBondBase * , QColor> >() ) );
+
+    // names can have all sorts in them, so only the safe bits are used
+    string stem = exp_.mols_[mol_num].name_;
+    for( int i = 0 , is = stem.length() ; i < is ; ++i ) {
+      if( !isalnum( static_cast<unsigned char>( stem[i] ) ) && '-' != stem[i] && '.' != stem[i] ) {
+        stem[i] = '_';
+      }
+    }
+    if( stem.empty() ) {
+      stem = "mol";
+    }
+
+    return OERenderMolecule( file_name( mol_num + 1 , stem ) , *disp );
+
+  }
+
+  bool write_page( int page_num , int worker_num ) {
+
+    int num_rows = exp_.num_rows_ , num_cols = exp_.num_cols_;
+    OEImage image( double( num_cols * exp_.width_ ) , double( num_rows * exp_.height_ ) );
+    OEImageGrid grid( image , num_rows , num_cols );
+
+    int mol_num = page_num * num_rows * num_cols;
+    for( OEIter<OEImageBase> cell = grid.GetCells() ;
+         cell && mol_num < int( exp_.mols_.size() ) ; ++cell , ++mol_num ) {
+      scoped_ptr<OEMolBase> mol( OENewMolBase( OEMolBaseType::OEDefault ) );
+      vector<pair<OEAtomBase * , QColor> > atom_colours;
+      prepare_mol( mol_num , worker_num , *mol , atom_colours );
+      scoped_ptr<OE2DMolDisplay> disp( DACLIB::create_oe_mol_display( int( cell->GetWidth() ) ,
+                                                                      int( cell->GetHeight() ) , *mol ,
+                                                                      sub_searches_[worker_num].empty() ,
+                                                                      vector<pair<OEAtomBase * , string> >() ,
+                                                                      atom_colours ,
+                                                                      vector<pair<OEBondBase * , QColor> >() ) );
+      OERenderMolecule( *cell , *disp );
+    }
+
+    return OEWriteImage( file_name( page_num + 1 , "page" ) , image );
+
+  }
+
+};
+
+// ****************************************************************************
+SmiVDepictionExport::SmiVDepictionExport( const vector<pSmiVRec> &recs ,
+                                          const SmiVSubSearches &sub_searches ,
+                                          int hits_key ) :
+  sub_searches_( sub_searches ) , width_( DEFAULT_WIDTH ) , height_( DEFAULT_HEIGHT ) ,
+  num_rows_( 0 ) , num_cols_( 0 ) {
+
+  mols_.resize( recs.size() );
+  for( int i = 0 , is = recs.size() ; i < is ; ++i ) {
+    mols_[i].smiles_ = recs[i]->in_smi();
+    mols_[i].name_ = recs[i]->smi_name();
+    mols_[i].coords_2d_ = recs[i]->coords_2d();
+    if( !sub_searches_.empty() && recs[i]->has_hits( hits_key ) ) {
+      vector<string> hit_labels;
+      recs[i]->get_hits( mols_[i].hit_counts_ , hit_labels );
+    }
+  }
+
+}
+
+// ****************************************************************************
+void SmiVDepictionExport::set_mol_size( int width , int height ) {
+
+  width_ = width;
+  height_ = height;
+
+}
+
+// ****************************************************************************
+void SmiVDepictionExport::set_grid( int num_rows , int num_cols ) {
+
+  num_rows_ = num_rows;
+  num_cols_ = num_cols;
+
+}
+
+// ****************************************************************************
+bool SmiVDepictionExport::can_write_format( const string &format ) {
+
+  return OEIsRegisteredImageFile( format );
+
+}
+
+// ****************************************************************************
+int SmiVDepictionExport::write( const string &out_dir , const string &format ,
+                                QWidget *parent ) {
+
+  if( mols_.empty() || !can_write_format( format ) ) {
+    return 0;
+  }
+
+  SmiVExportWorker worker( *this , out_dir , format );
+  DACLIB::parallel_for( worker , worker.num_files() , parent ,
+                        parent ? QString( "Exporting %1 molecules." ).arg( mols_.size() ) : QString() );
+
+  return worker.num_written();
+
+}
@@ -11,7 +11,12 @@
 #include <QFrame>
 #include <QLayout>
 #include <QLineEdit>
+#include <QListWidget>
 #include <QPushButton>
+#include <QTimer>
+
+// how long the user must stop typing for before the search is done
+static const int LIVE_SEARCH_DELAY_MS = 150;
 
 // ****************************************************************************
 SmiVFindMoleculeDialog::SmiVFindMoleculeDialog( QWidget *parent ,
@@ -31,15 +36,60 @@ void SmiVFindMoleculeDialog::build_widget() {
   search_mode_->addItem( "Starts With" );
   search_mode_->addItem( "Contains" );
 
+  matches_ = new QListWidget;
+  connect( matches_ , SIGNAL( itemClicked( QListWidgetItem * ) ) ,
+           this , SLOT( slot_match_chosen( QListWidgetItem * ) ) );
+  connect( matches_ , SIGNAL( itemActivated( QListWidgetItem * ) ) ,
+           this , SLOT( slot_match_chosen( QListWidgetItem * ) ) );
+
+  search_timer_ = new QTimer( this );
+  search_timer_->setSingleShot( true );
+  search_timer_->setInterval( LIVE_SEARCH_DELAY_MS );
+  connect( search_timer_ , SIGNAL( timeout() ) ,
+           this , SLOT( slot_search_timer_fired() ) );
+  connect( mol_name_ , SIGNAL( textEdited( const QString & ) ) ,
+           this , SLOT( slot_search_changed() ) );
+  connect( search_mode_ , SIGNAL( currentIndexChanged( int ) ) ,
+           this , SLOT( slot_search_changed() ) );
+
   QVBoxLayout *vbox = new QVBoxLayout;
   vbox->addWidget( mol_name_ );
   vbox->addWidget( search_mode_ );
+  vbox->addWidget( matches_ );
   vbox->addWidget( build_action_box() );
 
   setLayout( vbox );
 
 }
 
+// ****************************************************************************
+void SmiVFindMoleculeDialog::set_matches( const QStringList &labels ,
+                                          const QList<int> &mol_nums ,
+                                          bool more_matches ) {
+
+  matches_->clear();
+  for( int i = 0 , is = labels.size() ; i < is ; ++i ) {
+    QListWidgetItem *item = new QListWidgetItem( labels[i] , matches_ );
+    item->setData( Qt::UserRole , mol_nums[i] );
+  }
+  if( labels.isEmpty() ) {
+    set_matches_message( "No matches." );
+  } else if( more_matches ) {
+    QListWidgetItem *item = new QListWidgetItem( "More..." , matches_ );
+    item->setFlags( Qt::NoItemFlags );
+  }
+
+}
+
+// ****************************************************************************
+void SmiVFindMoleculeDialog::set_matches_message( const QString &msg ) {
+
+  matches_->clear();
+  QListWidgetItem *item = new QListWidgetItem( msg , matches_ );
+  item->setFlags( Qt::NoItemFlags );
+
+}
+
 // ****************************************************************************
 QWidget *SmiVFindMoleculeDialog::build_action_box() {
 
@@ -92,3 +142,33 @@ void SmiVFindMoleculeDialog::emit_search_details() {
 
 }
 
+// ****************************************************************************
+// start the wait again, so only the last of a run of changes is searched for.
+void SmiVFindMoleculeDialog::slot_search_changed() {
+
+  search_timer_->start();
+
+}
+
+// ****************************************************************************
+void SmiVFindMoleculeDialog::slot_search_timer_fired() {
+
+  if( mol_name_->text().isEmpty() ) {
+    matches_->clear();
+    return;
+  }
+
+  emit( live_search_name( mol_name_->text() ,
+                          search_mode_->currentIndex() ) );
+
+}
+
+// ****************************************************************************
+void SmiVFindMoleculeDialog::slot_match_chosen( QListWidgetItem *item ) {
+
+  QVariant mol_num = item->data( Qt::UserRole );
+  if( mol_num.isValid() ) {
+    emit( molecule_number_chosen( mol_num.toInt() ) );
+  }
+
+}
@@ -0,0 +1,513 @@
+//
+// file SmiVFingerprints.cc
+//
+
+#include "SmiVFingerprints.H"
+#include "SmiVRecord.H"
+
+#include "QTParallelFor.H"
+
+#include <algorithm>
+
+#include <QProgressDialog>
+
+#include <oechem.h>
+#include <oegraphsim.h>
+
+using namespace std;
+using namespace OEChem;
+using namespace OEGraphSim;
+
+namespace DACLIB {
+  // in apply_daylight_arom_model_to_oemol.cc
+  void apply_daylight_aromatic_model( OEMolBase &mol );
+}
+
+namespace {
+
+// the records are handed out to the threads this many at a time
+static const int FPS_PER_BLOCK = 4096;
+// and this many when each is compared with lots of others
+static const int NBR_FPS_PER_BLOCK = 256;
+
+// ****************************************************************************
+// Nearly all the time goes on counting the bits two fingerprints have in
+// common. Not every x86 CPU has the popcount instruction, so there's a version
+// that uses it and one that doesn't, and common_bits is pointed at the right
+// one when the program starts.
+inline int portable_popcount( quint64 word ) {
+
+  word = word - ( ( word >> 1 ) & Q_UINT64_C( 0x5555555555555555 ) );
+  word = ( word & Q_UINT64_C( 0x3333333333333333 ) ) + ( ( word >> 2 ) & Q_UINT64_C( 0x3333333333333333 ) );
+  word = ( word + ( word >> 4 ) ) & Q_UINT64_C( 0x0F0F0F0F0F0F0F0F );
+  return int( ( word * Q_UINT64_C( 0x0101010101010101 ) ) >> 56 );
+
+}
+
+// ****************************************************************************
+int portable_common_bits( const quint64 *fp1 , const quint64 *fp2 ) {
+
+  int common = 0;
+  for( int i = 0 ; i < SmiVFingerprints::NUM_WORDS ; ++i ) {
+    common += portable_popcount( fp1[i] & fp2[i] );
+  }
+  return common;
+
+}
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#define SMIV_POPCNT_DISPATCH
+// ****************************************************************************
+// only compiled for the instruction, so only called if the CPU has it.
+__attribute__((target("popcnt")))
+int popcnt_common_bits( const quint64 *fp1 , const quint64 *fp2 ) {
+
+  int common = 0;
+  for( int i = 0 ; i < SmiVFingerprints::NUM_WORDS ; ++i ) {
+    common += __builtin_popcountll( fp1[i] & fp2[i] );
+  }
+  return common;
+
+}
+#endif
+
+// ****************************************************************************
+typedef int (*CommonBitsFn)( const quint64 * , const quint64 * );
+
+CommonBitsFn pick_common_bits() {
+
+#ifdef SMIV_POPCNT_DISPATCH
+  __builtin_cpu_init();
+  if( __builtin_cpu_supports( "popcnt" ) ) {
+    return popcnt_common_bits;
+  }
+#endif
+  return portable_common_bits;
+
+}
+
+const CommonBitsFn common_bits = pick_common_bits();
+
+// ****************************************************************************
+inline int fp_bit_count( const quint64 *fp ) {
+
+  return common_bits( fp , fp );
+
+}
+
+// ****************************************************************************
+// higher similarity first, then lower position.
+class HitBetter {
+public :
+  bool operator()( const pair<float,int> &lhs , const pair<float,int> &rhs ) const {
+    return lhs.first > rhs.first || ( lhs.first == rhs.first && lhs.second < rhs.second );
+  }
+};
+
+// ****************************************************************************
+// makes the fingerprints for a block of records at a time.
+class SmiVFingerprintMaker {
+public :
+  SmiVFingerprintMaker( const vector<pSmiVRec> &recs , vector<quint64> &bits ,
+                        vector<int> &bit_counts ) :
+    recs_( recs ) , bits_( bits ) , bit_counts_( bit_counts ) {}
+  void operator()( int block_num , int ) {
+    for( int i = block_num * FPS_PER_BLOCK ,
+         is = min( int( recs_.size() ) , ( block_num + 1 ) * FPS_PER_BLOCK ) ; i < is ; ++i ) {
+      quint64 *fp = &bits_[i * SmiVFingerprints::NUM_WORDS];
+      SmiVFingerprints::make_fingerprint( recs_[i]->in_smi() , fp );
+      bit_counts_[i] = fp_bit_count( fp );
+    }
+  }
+private :
+  const vector<pSmiVRec> &recs_;
+  vector<quint64> &bits_;
+  vector<int> &bit_counts_;
+};
+
+// ****************************************************************************
+// Each thread keeps the best hits it's seen in its own heap, with the worst
+// of them at the front. The Tanimoto coefficient of two fingerprints with
+// a and b bits set can't be more than min(a,b)/max(a,b), so once a heap's
+// full, any fingerprint that can't reach the worst hit in it isn't looked at.
+class SmiVSimilaritySearcher {
+public :
+  SmiVSimilaritySearcher( const quint64 *query , int num_fps , const vector<quint64> &bits ,
+                          const vector<int> &bit_counts , int num_hits ) :
+    query_( query ) , query_count_( fp_bit_count( query ) ) , num_fps_( num_fps ) ,
+    bits_( bits ) , bit_counts_( bit_counts ) , num_hits_( num_hits ) ,
+    heaps_( DACLIB::num_parallel_workers() ) {}
+
+  void operator()( int block_num , int worker_num ) {
+    vector<pair<float,int> > &heap = heaps_[worker_num];
+    for( int i = block_num * FPS_PER_BLOCK ,
+         is = min( num_fps_ , ( block_num + 1 ) * FPS_PER_BLOCK ) ; i < is ; ++i ) {
+      int fp_count = bit_counts_[i];
+      bool full = int( heap.size() ) == num_hits_;
+      if( full ) {
+        int lo = min( fp_count , query_count_ ) , hi = max( fp_count , query_count_ );
+        if( !hi || float( lo ) / float( hi ) < heap.front().first ) {
+          continue;
+        }
+      }
+      int common = common_bits( query_ , &bits_[i * SmiVFingerprints::NUM_WORDS] );
+      int either = query_count_ + fp_count - common;
+      pair<float,int> hit( either ? float( common ) / float( either ) : 0.0F , i );
+      if( !full ) {
+        heap.push_back( hit );
+        push_heap( heap.begin() , heap.end() , HitBetter() );
+      } else if( HitBetter()( hit , heap.front() ) ) {
+        pop_heap( heap.begin() , heap.end() , HitBetter() );
+        heap.back() = hit;
+        push_heap( heap.begin() , heap.end() , HitBetter() );
+      }
+    }
+  }
+
+  void best_hits( vector<pair<float,int> > &hits ) const {
+    hits.clear();
+    for( int i = 0 , is = heaps_.size() ; i < is ; ++i ) {
+      hits.insert( hits.end() , heaps_[i].begin() , heaps_[i].end() );
+    }
+    int num_to_keep = min( num_hits_ , int( hits.size() ) );
+    partial_sort( hits.begin() , hits.begin() + num_to_keep , hits.end() , HitBetter() );
+    hits.resize( num_to_keep );
+  }
+
+private :
+  const quint64 *query_;
+  int query_count_ , num_fps_;
+  const vector<quint64> &bits_;
+  const vector<int> &bit_counts_;
+  int num_hits_;
+  vector<vector<pair<float,int> > > heaps_;
+};
+
+// ****************************************************************************
+// Finds all the neighbours of a block of fingerprints at a time. The
+// fingerprints are taken in order of bit count, so that neighbouring blocks
+// compare against much the same fingerprints, and a Tanimoto coefficient of
+// t between fingerprints with a and b bits set needs b between t*a and a/t,
+// so only that range of bit counts is looked at. Each fingerprint's list of
+// neighbours is only written by the thread doing it.
+class SmiVNeighbourFinder {
+public :
+  SmiVNeighbourFinder( float threshold , const vector<quint64> &bits ,
+                       const vector<int> &bit_counts , const vector<int> &count_order ,
+                       vector<vector<int> > &nbrs ) :
+    threshold_( threshold ) , bits_( bits ) , bit_counts_( bit_counts ) ,
+    count_order_( count_order ) , nbrs_( nbrs ) {
+    sorted_counts_.reserve( count_order_.size() );
+    for( int i = 0 , is = count_order_.size() ; i < is ; ++i ) {
+      sorted_counts_.push_back( bit_counts_[count_order_[i]] );
+    }
+  }
+
+  void operator()( int block_num , int ) {
+    for( int k = block_num * NBR_FPS_PER_BLOCK ,
+         ks = min( int( count_order_.size() ) , ( block_num + 1 ) * NBR_FPS_PER_BLOCK ) ; k < ks ; ++k ) {
+      int i = count_order_[k];
+      int i_count = bit_counts_[i];
+      // a bit either side, so rounding can't lose any
+      int lo_count = int( threshold_ * i_count ) - 1;
+      int hi_count = threshold_ > 0.0F ? int( i_count / threshold_ ) + 1 : SmiVFingerprints::NUM_BITS;
+      const quint64 *i_fp = &bits_[i * SmiVFingerprints::NUM_WORDS];
+      vector<int> &i_nbrs = nbrs_[i];
+      for( int m = lower_bound( sorted_counts_.begin() , sorted_counts_.end() , lo_count ) - sorted_counts_.begin() ,
+           ms = upper_bound( sorted_counts_.begin() , sorted_counts_.end() , hi_count ) - sorted_counts_.begin() ;
+           m < ms ; ++m ) {
+        int j = count_order_[m];
+        if( j == i ) {
+          continue;
+        }
+        int common = common_bits( i_fp , &bits_[j * SmiVFingerprints::NUM_WORDS] );
+        int either = i_count + bit_counts_[j] - common;
+        if( either && float( common ) / float( either ) >= threshold_ ) {
+          i_nbrs.push_back( j );
+        }
+      }
+      sort( i_nbrs.begin() , i_nbrs.end() );
+    }
+  }
+
+private :
+  float threshold_;
+  const vector<quint64> &bits_;
+  const vector<int> &bit_counts_;
+  const vector<int> &count_order_;
+  vector<int> sorted_counts_;
+  vector<vector<int> > &nbrs_;
+};
+
+// ****************************************************************************
+// more neighbours first, then lower position.
+class MoreNeighbours {
+public :
+  MoreNeighbours( const vector<vector<int> > &nbrs ) : nbrs_( nbrs ) {}
+  bool operator()( int lhs , int rhs ) const {
+    return nbrs_[lhs].size() > nbrs_[rhs].size() ||
+        ( nbrs_[lhs].size() == nbrs_[rhs].size() && lhs < rhs );
+  }
+private :
+  const vector<vector<int> > &nbrs_;
+};
+
+// ****************************************************************************
+// For MaxMin picking. Each fingerprint's greatest similarity to the picks so
+// far is kept, and on each round is updated with just the latest pick, while
+// each thread finds the fingerprint in its share with the lowest. Those
+// already picked are marked with a similarity of 2. If the bit counts say a
+// fingerprint can't be more like the latest pick than one already picked,
+// it's not compared.
+class SmiVMaxMinUpdater {
+public :
+  SmiVMaxMinUpdater( int num_fps , const vector<quint64> &bits ,
+                     const vector<int> &bit_counts , vector<float> &max_sims ) :
+    num_fps_( num_fps ) , bits_( bits ) , bit_counts_( bit_counts ) ,
+    max_sims_( max_sims ) , pick_( -1 ) ,
+    best_( DACLIB::num_parallel_workers() ) {}
+
+  void set_pick( int pick ) {
+    pick_ = pick;
+    max_sims_[pick] = 2.0F;
+    fill( best_.begin() , best_.end() , make_pair( 3.0F , -1 ) );
+  }
+
+  // the position of the fingerprint least like the picks, -1 if there are
+  // none left.
+  int next_pick() const {
+    pair<float,int> best( 3.0F , -1 );
+    for( int i = 0 , is = best_.size() ; i < is ; ++i ) {
+      if( -1 != best_[i].second && best_[i] < best ) {
+        best = best_[i];
+      }
+    }
+    return best.second;
+  }
+
+  void operator()( int block_num , int worker_num ) {
+    const quint64 *pick_fp = &bits_[pick_ * SmiVFingerprints::NUM_WORDS];
+    int pick_count = bit_counts_[pick_];
+    pair<float,int> &best = best_[worker_num];
+    for( int i = block_num * FPS_PER_BLOCK ,
+         is = min( num_fps_ , ( block_num + 1 ) * FPS_PER_BLOCK ) ; i < is ; ++i ) {
+      float &max_sim = max_sims_[i];
+      if( max_sim > 1.0F ) {
+        continue;
+      }
+      int lo = min( pick_count , bit_counts_[i] ) , hi = max( pick_count , bit_counts_[i] );
+      if( hi && float( lo ) / float( hi ) > max_sim ) {
+        int common = common_bits( pick_fp , &bits_[i * SmiVFingerprints::NUM_WORDS] );
+        float sim = float( common ) / float( pick_count + bit_counts_[i] - common );
+        if( sim > max_sim ) {
+          max_sim = sim;
+        }
+      }
+      // ties go to the lowest position, whichever thread sees it, so the
+      // picks are the same every time
+      if( make_pair( max_sim , i ) < best ) {
+        best = make_pair( max_sim , i );
+      }
+    }
+  }
+
+private :
+  int num_fps_;
+  const vector<quint64> &bits_;
+  const vector<int> &bit_counts_;
+  vector<float> &max_sims_;
+  int pick_;
+  vector<pair<float,int> > best_; // for each thread
+};
+
+// ****************************************************************************
+bool bigger_cluster( const vector<int> &lhs , const vector<int> &rhs ) {
+
+  return lhs.size() > rhs.size();
+
+}
+
+} // EO anonymous namespace
+
+// ****************************************************************************
+SmiVFingerprints::SmiVFingerprints() : num_fps_( 0 ) {
+
+}
+
+// ****************************************************************************
+bool SmiVFingerprints::make( const vector<pSmiVRec> &recs , QWidget *parent ) {
+
+  bits_.assign( recs.size() * NUM_WORDS , 0 );
+  bit_counts_.assign( recs.size() , 0 );
+  num_fps_ = 0;
+
+  SmiVFingerprintMaker maker( recs , bits_ , bit_counts_ );
+  int num_blocks = ( int( recs.size() ) + FPS_PER_BLOCK - 1 ) / FPS_PER_BLOCK;
+  if( !DACLIB::parallel_for( maker , num_blocks , parent , "Making fingerprints." ) ) {
+    vector<quint64>().swap( bits_ );
+    vector<int>().swap( bit_counts_ );
+    return false;
+  }
+
+  num_fps_ = recs.size();
+  return true;
+
+}
+
+// ****************************************************************************
+void SmiVFingerprints::make_subset( const SmiVFingerprints &all ,
+                                    const vector<int> &positions ) {
+
+  bits_.resize( positions.size() * NUM_WORDS );
+  bit_counts_.resize( positions.size() );
+  for( int i = 0 , is = positions.size() ; i < is ; ++i ) {
+    copy( all.bits_.begin() + positions[i] * NUM_WORDS ,
+          all.bits_.begin() + ( positions[i] + 1 ) * NUM_WORDS ,
+          bits_.begin() + i * NUM_WORDS );
+    bit_counts_[i] = all.bit_counts_[positions[i]];
+  }
+  num_fps_ = positions.size();
+
+}
+
+// ****************************************************************************
+// OEChem's path fingerprint, folded down to NUM_BITS by wrapping its bits
+// round.
+void SmiVFingerprints::make_fingerprint( const string &smiles , quint64 *fp ) {
+
+  fill( fp , fp + NUM_WORDS , 0 );
+  OEGraphMol mol;
+  if( !OEParseSmiles( mol , smiles ) ) {
+    return;
+  }
+  DACLIB::apply_daylight_aromatic_model( mol );
+
+  OEFingerPrint oe_fp;
+  OEMakeFP( oe_fp , mol , OEFPType::Path );
+  for( unsigned int i = 0 , is = oe_fp.GetSize() ; i < is ; ++i ) {
+    if( oe_fp.IsBitOn( i ) ) {
+      unsigned int bit = i % NUM_BITS;
+      fp[bit / 64] |= Q_UINT64_C( 1 ) << ( bit % 64 );
+    }
+  }
+
+}
+
+// ****************************************************************************
+void SmiVFingerprints::most_similar( const quint64 *query , int num_hits ,
+                                     vector<pair<float,int> > &hits ) const {
+
+  hits.clear();
+  if( !num_fps_ || num_hits < 1 ) {
+    return;
+  }
+
+  SmiVSimilaritySearcher searcher( query , num_fps_ , bits_ , bit_counts_ , num_hits );
+  int num_blocks = ( num_fps_ + FPS_PER_BLOCK - 1 ) / FPS_PER_BLOCK;
+  DACLIB::parallel_for( searcher , num_blocks );
+  searcher.best_hits( hits );
+
+}
+
+// ****************************************************************************
+bool SmiVFingerprints::neighbours( float threshold , vector<vector<int> > &nbrs ,
+                                   QWidget *parent ) const {
+
+  nbrs.assign( num_fps_ , vector<int>() );
+
+  // a counting sort, as there are only NUM_BITS + 1 possible counts
+  vector<int> count_starts( NUM_BITS + 2 , 0 );
+  for( int i = 0 ; i < num_fps_ ; ++i ) {
+    ++count_starts[bit_counts_[i] + 1];
+  }
+  for( int i = 1 , is = count_starts.size() ; i < is ; ++i ) {
+    count_starts[i] += count_starts[i - 1];
+  }
+  vector<int> count_order( num_fps_ );
+  for( int i = 0 ; i < num_fps_ ; ++i ) {
+    count_order[count_starts[bit_counts_[i]]++] = i;
+  }
+
+  SmiVNeighbourFinder finder( threshold , bits_ , bit_counts_ , count_order , nbrs );
+  int num_blocks = ( num_fps_ + NBR_FPS_PER_BLOCK - 1 ) / NBR_FPS_PER_BLOCK;
+  return DACLIB::parallel_for( finder , num_blocks , parent , "Finding neighbours." );
+
+}
+
+// ****************************************************************************
+bool SmiVFingerprints::butina_clusters( float threshold , vector<vector<int> > &clusters ,
+                                        QWidget *parent ) const {
+
+  clusters.clear();
+  vector<vector<int> > nbrs;
+  if( !neighbours( threshold , nbrs , parent ) ) {
+    return false;
+  }
+
+  vector<int> centroid_order( num_fps_ );
+  for( int i = 0 ; i < num_fps_ ; ++i ) {
+    centroid_order[i] = i;
+  }
+  sort( centroid_order.begin() , centroid_order.end() , MoreNeighbours( nbrs ) );
+
+  vector<char> in_cluster( num_fps_ , 0 );
+  for( int i = 0 ; i < num_fps_ ; ++i ) {
+    int centroid = centroid_order[i];
+    if( in_cluster[centroid] ) {
+      continue;
+    }
+    clusters.push_back( vector<int>( 1 , centroid ) );
+    in_cluster[centroid] = 1;
+    const vector<int> &cent_nbrs = nbrs[centroid];
+    for( int j = 0 , js = cent_nbrs.size() ; j < js ; ++j ) {
+      if( !in_cluster[cent_nbrs[j]] ) {
+        clusters.back().push_back( cent_nbrs[j] );
+        in_cluster[cent_nbrs[j]] = 1;
+      }
+    }
+  }
+
+  stable_sort( clusters.begin() , clusters.end() , bigger_cluster );
+  return true;
+
+}
+
+// ****************************************************************************
+bool SmiVFingerprints::max_min_pick( int num_picks , vector<int> &picks ,
+                                     QWidget *parent ) const {
+
+  picks.clear();
+  if( !num_fps_ || num_picks < 1 ) {
+    return true;
+  }
+
+  // a similarity of -1 rather than 0 so fingerprints with no bits set can
+  // still be picked.
+  vector<float> max_sims( num_fps_ , -1.0F );
+  SmiVMaxMinUpdater updater( num_fps_ , bits_ , bit_counts_ , max_sims );
+  int num_blocks = ( num_fps_ + FPS_PER_BLOCK - 1 ) / FPS_PER_BLOCK;
+
+  // the progress is over the picks, not each round of updates
+  QProgressDialog progress( "Picking diverse molecules." , "Cancel" , 0 , num_picks , parent );
+  progress.setWindowModality( Qt::WindowModal );
+  progress.setMinimumDuration( 500 );
+
+  int next_pick = 0;
+  while( -1 != next_pick ) {
+    picks.push_back( next_pick );
+    progress.setValue( picks.size() );
+    if( int( picks.size() ) == num_picks ) {
+      break;
+    }
+    QApplication::processEvents();
+    if( progress.wasCanceled() ) {
+      return false;
+    }
+    updater.set_pick( next_pick );
+    DACLIB::parallel_for( updater , num_blocks );
+    next_pick = updater.next_pick();
+  }
+
+  return true;
+
+}
@@ -0,0 +1,274 @@
+//
+// file SmiVGridView.cc
+//
+
+#include "SmiVGridView.H"
+#include "SmiVRecord.H"
+
+#include <QAction>
+#include <QContextMenuEvent>
+#include <QMenu>
+#include <QMouseEvent>
+#include <QPainter>
+#include <QScrollBar>
+#include <QWheelEvent>
+
+#include <algorithm>
+
+using namespace std;
+
+static const int MAX_GRID_SIZE = 8;
+
+// ****************************************************************************
+SmiVGridView::SmiVGridView( QWidget *parent , Qt::WindowFlags f ) :
+  QWidget( parent , f ) , coloured_mol_( true ) , num_rows_( 3 ) , num_cols_( 4 ) ,
+  top_row_( 0 ) , curr_mol_( -1 ) {
+
+  scroll_bar_ = new QScrollBar( Qt::Vertical , this );
+  connect( scroll_bar_ , SIGNAL( valueChanged( int ) ) ,
+           this , SLOT( slot_scroll_bar_changed( int ) ) );
+
+  depiction_cache_ = new SmiVDepictionCache( this );
+  connect( depiction_cache_ , SIGNAL( depiction_ready( pSmiVRec ) ) ,
+           this , SLOT( slot_depiction_ready() ) );
+
+  setMinimumSize( 200 , 200 );
+
+}
+
+// ****************************************************************************
+void SmiVGridView::set_data( const vector<pSmiVRec> &recs ,
+                             const SmiVSubSearches &sub_searches ,
+                             int hits_key , bool coloured_mol ) {
+
+  recs_ = recs;
+  sub_searches_ = sub_searches;
+  coloured_mol_ = coloured_mol;
+  depiction_cache_->clear();
+  depiction_cache_->set_hits_key( hits_key );
+  if( curr_mol_ >= int( recs_.size() ) ) {
+    curr_mol_ = int( recs_.size() ) - 1;
+  }
+
+  update_scroll_bar();
+  request_depictions();
+  update();
+
+}
+
+// ****************************************************************************
+void SmiVGridView::set_current_mol( int mol_num ) {
+
+  curr_mol_ = mol_num;
+  if( mol_num >= 0 ) {
+    int mol_row = mol_num / num_cols_;
+    if( mol_row < top_row_ ) {
+      scroll_bar_->setValue( mol_row );
+    } else if( mol_row >= top_row_ + num_rows_ ) {
+      scroll_bar_->setValue( mol_row - num_rows_ + 1 );
+    }
+  }
+  update();
+
+}
+
+// ****************************************************************************
+void SmiVGridView::set_grid_size( int num_rows , int num_cols ) {
+
+  if( num_rows < 1 || num_cols < 1 ||
+      ( num_rows == num_rows_ && num_cols == num_cols_ ) ) {
+    return;
+  }
+
+  num_rows_ = num_rows;
+  num_cols_ = num_cols;
+  // the cells are a new size, so everything has to be redone.
+  depiction_cache_->clear();
+  update_scroll_bar();
+  set_current_mol( curr_mol_ );
+  request_depictions();
+
+}
+
+// ****************************************************************************
+void SmiVGridView::paintEvent( QPaintEvent *event ) {
+
+  Q_UNUSED( event );
+
+  QPainter qp( this );
+  qp.fillRect( rect() , Qt::white );
+
+  QSize cs = cell_size();
+  int first_mol = top_row_ * num_cols_;
+  int last_mol = min( int( recs_.size() ) , first_mol + num_rows_ * num_cols_ );
+  for( int i = first_mol ; i < last_mol ; ++i ) {
+    QRect cell = cell_rect( i );
+    pSmiVDepiction dep = depiction_cache_->depiction( recs_[i] , cs , coloured_mol_ );
+    if( dep ) {
+      qp.drawImage( cell.topLeft() , dep->image_ );
+    } else {
+      qp.setPen( Qt::gray );
+      qp.drawText( cell , Qt::AlignCenter | Qt::TextWordWrap ,
+                   QString( recs_[i]->smi_name().c_str() ) );
+    }
+    if( i == curr_mol_ ) {
+      qp.setPen( QPen( Qt::blue , 2 ) );
+      qp.drawRect( cell.adjusted( 1 , 1 , -1 , -1 ) );
+    } else {
+      qp.setPen( Qt::lightGray );
+      qp.drawRect( cell.adjusted( 0 , 0 , -1 , -1 ) );
+    }
+  }
+
+}
+
+// ****************************************************************************
+void SmiVGridView::resizeEvent( QResizeEvent *event ) {
+
+  Q_UNUSED( event );
+
+  int sb_width = scroll_bar_->sizeHint().width();
+  scroll_bar_->setGeometry( width() - sb_width , 0 , sb_width , height() );
+  request_depictions();
+
+}
+
+// ****************************************************************************
+void SmiVGridView::wheelEvent( QWheelEvent *event ) {
+
+  // one row per click of the usual sort of wheel
+  int num_rows = -event->angleDelta().y() / 120;
+  if( num_rows ) {
+    scroll_bar_->setValue( scroll_bar_->value() + num_rows );
+  }
+  event->accept();
+
+}
+
+// ****************************************************************************
+void SmiVGridView::mousePressEvent( QMouseEvent *event ) {
+
+  int mol_num = mol_at( event->pos() );
+  if( -1 != mol_num && Qt::LeftButton == event->button() ) {
+    emit mol_selected( mol_num );
+  }
+
+}
+
+// ****************************************************************************
+void SmiVGridView::mouseDoubleClickEvent( QMouseEvent *event ) {
+
+  int mol_num = mol_at( event->pos() );
+  if( -1 != mol_num ) {
+    emit mol_double_clicked( mol_num );
+  }
+
+}
+
+// ****************************************************************************
+void SmiVGridView::contextMenuEvent( QContextMenuEvent *event ) {
+
+  QMenu menu( this );
+  QMenu *size_menu = menu.addMenu( "Grid Size" );
+  for( int i = 2 ; i <= MAX_GRID_SIZE ; ++i ) {
+    // a bit wider than it is high, as molecules tend to be.
+    QAction *act = size_menu->addAction( QString( "%1 x %2" ).arg( i ).arg( i + 1 ) );
+    act->setData( i );
+    act->setCheckable( true );
+    act->setChecked( i == num_rows_ && i + 1 == num_cols_ );
+  }
+
+  QAction *act = menu.exec( event->globalPos() );
+  if( act && act->data().isValid() ) {
+    int num_rows = act->data().toInt();
+    set_grid_size( num_rows , num_rows + 1 );
+  }
+
+}
+
+// ****************************************************************************
+QSize SmiVGridView::cell_size() const {
+
+  int grid_width = width() - scroll_bar_->width();
+  return QSize( max( 1 , grid_width / num_cols_ ) ,
+                max( 1 , height() / num_rows_ ) );
+
+}
+
+// ****************************************************************************
+QRect SmiVGridView::cell_rect( int mol_num ) const {
+
+  QSize cs = cell_size();
+  int row = mol_num / num_cols_ - top_row_;
+  int col = mol_num % num_cols_;
+
+  return QRect( QPoint( col * cs.width() , row * cs.height() ) , cs );
+
+}
+
+// ****************************************************************************
+int SmiVGridView::mol_at( const QPoint &pos ) const {
+
+  QSize cs = cell_size();
+  int col = pos.x() / cs.width();
+  int row = pos.y() / cs.height();
+  if( pos.x() < 0 || pos.y() < 0 || col >= num_cols_ || row >= num_rows_ ) {
+    return -1;
+  }
+
+  int mol_num = ( top_row_ + row ) * num_cols_ + col;
+  return mol_num < int( recs_.size() ) ? mol_num : -1;
+
+}
+
+// ****************************************************************************
+void SmiVGridView::update_scroll_bar() {
+
+  int tot_rows = ( int( recs_.size() ) + num_cols_ - 1 ) / num_cols_;
+  scroll_bar_->setRange( 0 , max( 0 , tot_rows - num_rows_ ) );
+  scroll_bar_->setSingleStep( 1 );
+  scroll_bar_->setPageStep( num_rows_ );
+  top_row_ = scroll_bar_->value();
+
+}
+
+// ****************************************************************************
+void SmiVGridView::request_depictions() {
+
+  if( recs_.empty() || !isVisible() ) {
+    return;
+  }
+
+  int page_size = num_rows_ * num_cols_;
+  int first_mol = top_row_ * num_cols_;
+  int num_recs = recs_.size();
+
+  vector<pSmiVRec> wanted;
+  wanted.reserve( 3 * page_size );
+  for( int i = first_mol , is = min( num_recs , first_mol + 2 * page_size ) ; i < is ; ++i ) {
+    wanted.push_back( recs_[i] );
+  }
+  for( int i = first_mol - 1 , is = max( 0 , first_mol - page_size ) ; i >= is ; --i ) {
+    wanted.push_back( recs_[i] );
+  }
+
+  depiction_cache_->request( wanted , cell_size() , coloured_mol_ , sub_searches_ );
+
+}
+
+// ****************************************************************************
+void SmiVGridView::slot_scroll_bar_changed( int new_val ) {
+
+  top_row_ = new_val;
+  request_depictions();
+  update();
+
+}
+
+// ****************************************************************************
+void SmiVGridView::slot_depiction_ready() {
+
+  // repaints are coalesced by Qt, so a burst of these is cheap.
+  update();
+
+}
@@ -0,0 +1,174 @@
+//
+// file SmiVMolFiles.cc
+//
+
+#include "SmiVMolFiles.H"
+#include "SmiVRecord.H"
+
+#include <oechem.h>
+
+#include <fstream>
+#include <iterator>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/foreach.hpp>
+#include <boost/iostreams/filtering_streambuf.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/lexical_cast.hpp>
+
+using namespace boost;
+using namespace std;
+using namespace OEChem;
+using namespace OESystem;
+
+namespace DACLIB {
+  void apply_daylight_aromatic_model( OEMolBase &mol );
+}
+
+namespace {
+
+// ****************************************************************************
+// The query needs a little TLC, as if it has R Groups in it, it may have
+// extraneous guff that OEChem doesn't seem to deal with. First, strip out
+// everything that starts with a $. Then, as soon as we hit M  END, stop as we
+// don't want anything after that.
+void store_next_mdl_query( const vector<string> &next_query ,
+                           const string &filename , int count ,
+                           vector<pair<string,string> > &queries ) {
+
+  string query_string;
+  BOOST_FOREACH( string next_line , next_query ) {
+    if( next_line.empty() || '$' != next_line[0] ) {
+      query_string += next_line + '\n';
+    }
+    if( string( "M  END") == next_line.substr( 0 , 6 ) ) {
+      break;
+    }
+  }
+
+  string short_name = filename.substr( filename.rfind( '/' ) + 1 );
+  queries.push_back( make_pair( short_name + "_" + lexical_cast<string>( count ) ,
+                                query_string ) );
+
+}
+
+} // EO anon namespace
+
+// ****************************************************************************
+void read_smiles_file( const string &filename , vector<pSmiVRec> &recs ) {
+
+  ifstream file( filename.c_str() , ios_base::in | ios_base::binary );
+  if( !file ) {
+    return;
+  }
+  boost::iostreams::filtering_streambuf<boost::iostreams::input> in;
+  if( ends_with( filename , ".smi.gz" ) ) {
+    in.push( boost::iostreams::gzip_decompressor() );
+  }
+  in.push( file );
+
+  istreambuf_iterator<char> init( &in ) , eos;
+
+  vector<char> nextline;
+  while( init != eos ) {
+    nextline.clear();
+    while( init != eos && *init != '\n' ) {
+      nextline.push_back( *init );
+      ++init;
+    }
+    boost::trim( nextline );
+    if( !nextline.empty() ) {
+      vector<string> split_line;
+      split( split_line , nextline , is_any_of( " ,\t" ) );
+      if( !split_line.empty() ) {
+        string mol_name;
+        if( split_line.size() > 1 ) {
+          mol_name = string( nextline.begin() + split_line[0].length() + 1 ,
+                             nextline.end() );
+          boost::trim( mol_name );
+        } else {
+          mol_name = string( "Mol" ) + lexical_cast<string>( recs.size() + 1 );
+        }
+        recs.push_back( pSmiVRec( new SmiVRecord( split_line[0] , mol_name ) ) );
+      }
+    }
+    if( init != eos ) {
+      ++init; // get past '\n'
+    }
+  }
+
+}
+
+// ****************************************************************************
+void read_other_mol_file( const string &filename , vector<pSmiVRec> &recs ) {
+
+  oemolistream ims;
+  if( !ims.open( filename ) ) {
+    return;
+  }
+  OEMol mol;
+  while( ims >> mol ) {
+    DACLIB::apply_daylight_aromatic_model( mol );
+    recs.push_back( pSmiVRec( new SmiVRecord( mol ) ) );
+  }
+
+}
+
+// ****************************************************************************
+void read_mol_file( const string &filename , vector<pSmiVRec> &recs ) {
+
+  if( ends_with( filename , ".smi" ) || ends_with( filename , ".smi.gz" ) ) {
+    read_smiles_file( filename , recs );
+  } else {
+    read_other_mol_file( filename , recs );
+  }
+
+}
+
+// ****************************************************************************
+bool read_mdl_query_file( const string &filename ,
+                          vector<pair<string,string> > &queries ) {
+
+  ifstream ifs( filename.c_str() );
+  if( !ifs || !ifs.good() ) {
+    return false;
+  }
+
+  int count = 0;
+  string next_line;
+  vector<string> next_query;
+  while( 1 ) {
+    getline( ifs , next_line );
+    if( ifs.eof() || !ifs.good() ) {
+      ++count;
+      store_next_mdl_query( next_query , filename , count , queries );
+      break;
+    }
+    if( next_line == string( "$$$$") ) {
+      ++count;
+      store_next_mdl_query( next_query , filename , count , queries );
+      next_query.clear();
+    } else {
+      next_query.push_back( next_line );
+    }
+  }
+
+  return true;
+
+}
+
+// ****************************************************************************
+OESubSearch *create_mdl_subsearch( const string &query ) {
+
+  oemolistream ims;
+  ims.openstring( query );
+  unsigned int aromodel = OEIFlavor::Generic::OEAroModelDaylight;
+  unsigned int qflavor  = ims.GetFlavor( OEFormat::MDL );
+  ims.SetFlavor( OEFormat::MDL , qflavor|aromodel );
+
+  OEQMol qmol;
+  OEReadMDLQueryFile( ims , qmol , OEMDLQueryOpts::Default );
+
+  return new OESubSearch( qmol );
+
+}
@@ -0,0 +1,166 @@
+//
+// file SmiVNameIndex.cc
+//
+
+#include "SmiVNameIndex.H"
+#include "SmiVRecord.H"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+
+// ****************************************************************************
+// positions in names, sorted by name and then position.
+class NameLess {
+public :
+  NameLess( const vector<string> &names ) : names_( names ) {}
+  bool operator()( int lhs , int rhs ) const {
+    int cmp = names_[lhs].compare( names_[rhs] );
+    return cmp < 0 || ( !cmp && lhs < rhs );
+  }
+  bool operator()( int lhs , const string &rhs ) const {
+    return names_[lhs] < rhs;
+  }
+  bool operator()( const string &lhs , int rhs ) const {
+    return lhs < names_[rhs];
+  }
+private :
+  const vector<string> &names_;
+};
+
+// ****************************************************************************
+// for upper_bound, to find the end of the names starting with prefix.
+class PrefixLess {
+public :
+  PrefixLess( const vector<string> &names ) : names_( names ) {}
+  bool operator()( const string &prefix , int rhs ) const {
+    return names_[rhs].compare( 0 , prefix.length() , prefix ) > 0;
+  }
+private :
+  const vector<string> &names_;
+};
+
+} // EO anonymous namespace
+
+// ****************************************************************************
+SmiVNameIndex::SmiVNameIndex( const vector<boost::shared_ptr<SmiVRecord> > &recs ) {
+
+  vector<string> names;
+  names.reserve( recs.size() );
+  sorted_.reserve( recs.size() );
+  for( int i = 0 , is = recs.size() ; i < is ; ++i ) {
+    names.push_back( recs[i]->smi_name() );
+    sorted_.push_back( i );
+  }
+  text_index_.set_texts( names );
+  sort( sorted_.begin() , sorted_.end() , NameLess( text_index_.texts() ) );
+
+  // each level is the one below with pairs of neighbouring blocks merged, as
+  // in a merge sort, up to a block that covers everything.
+  int num_recs = sorted_.size();
+  for( int block_size = MIN_BLOCK ; block_size < 2 * num_recs ; block_size *= 2 ) {
+    block_sorted_.push_back( vector<int>( num_recs ) );
+    vector<int> &blocks = block_sorted_.back();
+    for( int i = 0 ; i < num_recs ; i += block_size ) {
+      int mid = min( num_recs , i + block_size / 2 ) , end = min( num_recs , i + block_size );
+      if( MIN_BLOCK == block_size ) {
+        copy( sorted_.begin() + i , sorted_.begin() + end , blocks.begin() + i );
+        sort( blocks.begin() + i , blocks.begin() + end );
+      } else {
+        const vector<int> &halves = block_sorted_[block_sorted_.size() - 2];
+        merge( halves.begin() + i , halves.begin() + mid ,
+               halves.begin() + mid , halves.begin() + end , blocks.begin() + i );
+      }
+    }
+  }
+
+}
+
+// ****************************************************************************
+int SmiVNameIndex::find_next( const string &name , int search_mode , int start_pos ) const {
+
+  switch( search_mode ) {
+  case EXACT_MATCH : return find_exact( name , start_pos );
+  case STARTS_WITH : return find_starts_with( name , start_pos );
+  case CONTAINS : return text_index_.find_next( name , start_pos );
+  }
+
+  return -1;
+
+}
+
+// ****************************************************************************
+void SmiVNameIndex::find_all( const string &name , int search_mode , int max_hits ,
+                              vector<int> &hits ) const {
+
+  hits.clear();
+  int next_pos = -1;
+  while( int( hits.size() ) < max_hits ) {
+    next_pos = find_next( name , search_mode , next_pos );
+    if( -1 == next_pos ) {
+      break;
+    }
+    hits.push_back( next_pos );
+  }
+
+}
+
+// ****************************************************************************
+int SmiVNameIndex::find_exact( const string &name , int start_pos ) const {
+
+  pair<vector<int>::const_iterator,vector<int>::const_iterator> range =
+      equal_range( sorted_.begin() , sorted_.end() , name , NameLess( text_index_.texts() ) );
+  // the positions of equal names are in order
+  vector<int>::const_iterator p = upper_bound( range.first , range.second , start_pos );
+  return p == range.second ? -1 : *p;
+
+}
+
+// ****************************************************************************
+// The names starting with name are all together in sorted_, but in no
+// particular order of position. The range is covered by O(log n) blocks from
+// block_sorted_, each of which is sorted on position so has a binary search
+// for the first position after start_pos, plus at most 2 * MIN_BLOCK odd
+// ones at the ends which are looked at one by one. So it's O(log^2 n) however
+// many names match.
+int SmiVNameIndex::find_starts_with( const string &name , int start_pos ) const {
+
+  const vector<string> &names = text_index_.texts();
+  vector<int>::const_iterator lo = lower_bound( sorted_.begin() , sorted_.end() , name ,
+                                                NameLess( names ) );
+  vector<int>::const_iterator hi = upper_bound( lo , sorted_.end() , name ,
+                                                PrefixLess( names ) );
+
+  int next_pos = -1;
+  for( int i = lo - sorted_.begin() , is = hi - sorted_.begin() ; i < is ; ) {
+    // the biggest block starting at i that fits in the range
+    int level = -1;
+    while( level + 1 < int( block_sorted_.size() ) ) {
+      int block_size = MIN_BLOCK << ( level + 1 );
+      if( i % block_size || i + block_size > is ) {
+        break;
+      }
+      ++level;
+    }
+    if( -1 == level ) {
+      if( sorted_[i] > start_pos && ( -1 == next_pos || sorted_[i] < next_pos ) ) {
+        next_pos = sorted_[i];
+      }
+      ++i;
+      continue;
+    }
+    const vector<int> &blocks = block_sorted_[level];
+    int block_size = MIN_BLOCK << level;
+    vector<int>::const_iterator p = upper_bound( blocks.begin() + i ,
+                                                 blocks.begin() + i + block_size , start_pos );
+    if( p != blocks.begin() + i + block_size && ( -1 == next_pos || *p < next_pos ) ) {
+      next_pos = *p;
+    }
+    i += block_size;
+  }
+
+  return next_pos;
+
+}
@@ -5,6 +5,9 @@
 // 5th January 2010
 //
 
+#include "SmiVDepictionCache.H"
+#include "SmiVGridView.H"
+#include "SmiVNameIndex.H"
 #include "SmiVPanel.H"
 #include "SmiVRecord.H"
 
@@ -16,27 +19,81 @@
 #include <QLayout>
 #include <QLineEdit>
 #include <QMouseEvent>
+#include <QMutexLocker>
+#include <QRunnable>
 #include <QSlider>
+#include <QStackedWidget>
 
 #include <oechem.h>
+#include <oedepict.h>
 
 #include <boost/scoped_ptr.hpp>
 
 using namespace boost;
 using namespace std;
 using namespace OEChem;
+using namespace OEDepict;
+
+// molecules with more heavy atoms than this are sketched first when stepping
+// through them, and only drawn properly when the user stops.
+static const unsigned int LOD_HEAVY_ATOMS = 100;
+
+// ****************************************************************************
+// Makes a SmiVNameIndex in one of the SmiVPanel's threads. It has its own
+// copy of the list of records, so the panel can carry on changing its one.
+class SmiVNameIndexJob : public QRunnable {
+
+public :
+
+  SmiVNameIndexJob( SmiVPanel *panel , const vector<pSmiVRec> &recs , int generation ) :
+    panel_( panel ) , recs_( recs ) , generation_( generation ) {}
+
+  void run() {
+    boost::shared_ptr<SmiVNameIndex> index( new SmiVNameIndex( recs_ ) );
+    panel_->name_index_built( index , generation_ );
+  }
+
+private :
+
+  SmiVPanel *panel_;
+  vector<pSmiVRec> recs_;
+  int generation_;
+
+};
 
 // ****************************************************************************
 SmiVPanel::SmiVPanel( QWidget *parent , Qt::WindowFlags f ) :
-QWidget( parent , f ) , selected_( false ) {
+QWidget( parent , f ) , hits_key_( 0 ) , selected_( false ) ,
+  name_index_gen_( 0 ) , name_index_job_gen_( -1 ) , built_name_index_gen_( -1 ) {
+
+  // the jobs must finish in the order they were started, so that an old
+  // index can't replace a newer one.
+  name_index_pool_.setMaxThreadCount( 1 );
 
   build_widget();
 
 }
 
+// ****************************************************************************
+SmiVPanel::~SmiVPanel() {
+
+  name_index_pool_.waitForDone();
+
+}
+
 // ****************************************************************************
 void SmiVPanel::add_data( const vector<pSmiVRec> &new_recs ) {
 
+  // these must be cleared before the first molecule is displayed, or it'll
+  // be coloured and cached using the old sub-searches.
+  sub_searches_.clear();
+  hits_key_ = 0;
+  dropped_recs_.clear();
+  depiction_cache_->clear();
+  depiction_cache_->set_hits_key( hits_key_ );
+  render_in_flight_.reset();
+  clear_name_index();
+
   if( new_recs.empty() ) {
     smiv_recs_.clear();
     mol_slider_->setDisabled( true );
@@ -44,24 +101,32 @@ void SmiVPanel::add_data( const vector<pSmiVRec> &new_recs ) {
     in_smi_->setText( "" );
     can_smi_->setText( "" );
     msg_->setText( "" );
+    refresh_grid();
   } else {
     smiv_recs_ = new_recs;
     mol_slider_->setEnabled( true );
     mol_slider_->setMinimum( 0 );
     mol_slider_->setMaximum( int( smiv_recs_.size() - 1 ) );
+    refresh_grid();
     slot_mol_slider_changed();
   }
 
-  sub_searches_.clear();
-  dropped_recs_.clear();
-
 }
 
 // ****************************************************************************
-void SmiVPanel::set_subsearches( const vector<pair<boost::shared_ptr<OESubSearch>,string> > &ss ) {
+void SmiVPanel::set_subsearches( const vector<pair<boost::shared_ptr<OESubSearch>,string> > &ss ,
+                                 int hits_key ) {
 
   sub_searches_ = ss;
-  colour_atoms();
+  hits_key_ = hits_key;
+  depiction_cache_->clear();
+  depiction_cache_->set_hits_key( hits_key_ );
+  render_in_flight_.reset();
+  refresh_grid();
+  if( !grid_mode() ) {
+    colour_atoms();
+    prefetch_neighbours();
+  }
 
 }
 
@@ -70,33 +135,63 @@ void SmiVPanel::set_subsearches( const vector<pair<boost::shared_ptr<OESubSearch
 // search mode - 0 for Exact Match, 1 for Starts With, 2 for Contains
 bool SmiVPanel::show_molecule( string mol_name , int search_mode ) {
 
-  int start_num = 0 == search_mode ? 0 : mol_slider_->value() + 1;
-  bool found_mol( false );
-  for( int i = start_num , is = smiv_recs_.size() ; i < is ; ++i ) {
-    switch( search_mode ) {
-    case 0 :
-      if( smiv_recs_[i]->smi_name() == mol_name ) {
-        found_mol = true;
-      }
-      break;
-    case 1 :
-      if( smiv_recs_[i]->smi_name().substr( 0 , mol_name.length() ) == mol_name ) {
-        found_mol = true;
-      }
-      break;
-    case 2 :
-      if( string::npos != smiv_recs_[i]->smi_name().find( mol_name ) ) {
-        found_mol = true;
-      }
-      break;
-    }
-    if( found_mol ) {
-      mol_slider_->setValue( i );
-      return true;
-    }
+  int start_num = 0 == search_mode ? -1 : mol_slider_->value();
+  int mol_num = name_index().find_next( mol_name , search_mode , start_num );
+  if( -1 == mol_num ) {
+    return false;
+  }
+
+  mol_slider_->setValue( mol_num );
+  return true;
+
+}
+
+// ****************************************************************************
+bool SmiVPanel::find_molecules( const string &mol_name , int search_mode , int max_hits ,
+                                vector<int> &mol_nums ) {
+
+  mol_nums.clear();
+  if( !name_index_ ) {
+    start_name_index();
+    return false;
   }
 
-  return false;
+  name_index_->find_all( mol_name , search_mode , max_hits , mol_nums );
+  return true;
+
+}
+
+// ****************************************************************************
+void SmiVPanel::start_name_index() {
+
+  if( name_index_ || name_index_job_gen_ == name_index_gen_ ) {
+    return;
+  }
+
+  name_index_job_gen_ = name_index_gen_;
+  name_index_pool_.start( new SmiVNameIndexJob( this , smiv_recs_ , name_index_gen_ ) );
+
+}
+
+// ****************************************************************************
+void SmiVPanel::show_molecule_number( int mol_num ) {
+
+  if( mol_num >= 0 && mol_num < int( smiv_recs_.size() ) ) {
+    mol_slider_->setValue( mol_num );
+  }
+
+}
+
+// ****************************************************************************
+void SmiVPanel::name_index_built( boost::shared_ptr<SmiVNameIndex> index , int generation ) {
+
+  {
+    QMutexLocker lock( &name_index_mutex_ );
+    built_name_index_ = index;
+    built_name_index_gen_ = generation;
+  }
+
+  QMetaObject::invokeMethod( this , "slot_name_index_built" , Qt::QueuedConnection );
 
 }
 
@@ -168,7 +263,23 @@ void SmiVPanel::build_widget() {
   QVBoxLayout *vbox = new QVBoxLayout;
 
   mol_disp_ = new DACLIB::QTMolDisplay2D;
-  vbox->addWidget( mol_disp_ , 1 ); // add stretch, so it's this that grows, not the QLabels
+  // so that re-drawing a big molecule, after a resize or re-colouring say,
+  // doesn't hold up the other panel and the data table.
+  mol_disp_->set_async_rendering( true );
+  mol_disp_->set_lod_threshold( LOD_HEAVY_ATOMS );
+  depiction_cache_ = new SmiVDepictionCache( this );
+  grid_view_ = new SmiVGridView;
+  disp_stack_ = new QStackedWidget;
+  disp_stack_->addWidget( mol_disp_ );
+  disp_stack_->addWidget( grid_view_ );
+  vbox->addWidget( disp_stack_ , 1 ); // add stretch, so it's this that grows, not the QLabels
+
+  connect( depiction_cache_ , SIGNAL( depiction_ready( pSmiVRec ) ) ,
+           this , SLOT( slot_depiction_ready( pSmiVRec ) ) );
+  connect( grid_view_ , SIGNAL( mol_selected( int ) ) ,
+           this , SLOT( slot_grid_mol_selected( int ) ) );
+  connect( grid_view_ , SIGNAL( mol_double_clicked( int ) ) ,
+           this , SLOT( slot_grid_mol_double_clicked( int ) ) );
 
   QHBoxLayout *hbox1 = new QHBoxLayout;
   hbox1->addWidget( new QLabel( "Input SMILES  ") );
@@ -229,7 +340,99 @@ void SmiVPanel::colour_atoms() {
 
   // colouring by subsearch requires black and white molecule drawing
   mol_disp_->set_coloured_mol( false );
-  mol_disp_->colour_atoms( sub_searches_ );
+  pSmiVRec rec = current_smiv_rec();
+  if( rec && rec->has_hits( hits_key_ ) ) {
+    vector<unsigned int> hit_counts;
+    vector<string> hit_labels;
+    rec->get_hits( hit_counts , hit_labels );
+    mol_disp_->colour_atoms_by_hit_counts( hit_counts , hit_labels );
+  } else {
+    mol_disp_->colour_atoms( sub_searches_ );
+  }
+
+}
+
+// ****************************************************************************
+bool SmiVPanel::display_coloured_mol() const {
+
+  return sub_searches_.empty() ? mol_disp_->coloured_mol() : false;
+
+}
+
+// ****************************************************************************
+void SmiVPanel::prefetch_neighbours() {
+
+  if( smiv_recs_.empty() ) {
+    return;
+  }
+
+  depiction_cache_->prefetch( smiv_recs_ , mol_slider_->value() , mol_disp_->size() ,
+                              display_coloured_mol() , sub_searches_ );
+
+}
+
+// ****************************************************************************
+void SmiVPanel::show_current_depiction() {
+
+  if( smiv_recs_.empty() || grid_mode() ) {
+    return;
+  }
+
+  const pSmiVRec &rec = smiv_recs_[mol_slider_->value()];
+  bool coloured_mol = display_coloured_mol();
+  pSmiVDepiction dep = depiction_cache_->depiction( rec , mol_disp_->size() , coloured_mol );
+  if( dep ) {
+    mol_disp_->set_coloured_mol( coloured_mol );
+    mol_disp_->set_rendered_molecule( dep->mol_ , dep->disp_ , dep->image_ ,
+                                      dep->hit_counts_ , dep->hit_labels_ );
+    // this needs the SMILES parsing, so it's left until the user stops here
+    if( rec->can_smi().empty() ) {
+      rec->create_can_smi();
+    }
+    can_smi_->setText( rec->can_smi().c_str() );
+    can_smi_->setCursorPosition( 0 );
+    if( !render_in_flight_ ) {
+      prefetch_neighbours();
+    }
+    return;
+  }
+
+  // A big molecule that's been seen before can be sketched from its stored
+  // coords straight away, which is more use than the name while stepping
+  // through a set of peptides, say. Small ones will be along shortly anyway.
+  bool previewed = false;
+  if( rec->has_2d_coords() ) {
+    scoped_ptr<OEMolBase> mol( OENewMolBase( OEMolBaseType::OEDefault ) );
+    OEParseSmiles( *mol , rec->in_smi() );
+    if( mol_disp_->needs_lod( *mol ) && rec->apply_2d_coords( *mol ) ) {
+      mol->SetTitle( rec->smi_name() );
+      // the coords are there, so this just suppresses the hydrogens
+      OEPrepareDepiction( *mol , false );
+      mol_disp_->set_preview_molecule( mol.get() );
+      previewed = true;
+    }
+  }
+  if( !previewed ) {
+    mol_disp_->set_placeholder( QString( rec->smi_name().c_str() ) );
+  }
+  // one frame at a time. If one's already being drawn, the latest molecule
+  // will be asked for when it arrives, and anything in between skipped.
+  if( !render_in_flight_ ) {
+    render_in_flight_ = rec;
+    prefetch_neighbours();
+  }
+
+}
+
+// ****************************************************************************
+void SmiVPanel::refresh_grid() {
+
+  if( !grid_mode() ) {
+    return;
+  }
+
+  grid_view_->set_data( smiv_recs_ , sub_searches_ , hits_key_ , display_coloured_mol() );
+  grid_view_->set_current_mol( smiv_recs_.empty() ? -1 : mol_slider_->value() );
 
 }
 
@@ -244,8 +447,10 @@ void SmiVPanel::drop_current_mol() {
   dropped_recs_.push_back( make_pair( smiv_recs_[mol_num] , mol_num ) );
   copy( smiv_recs_.begin() + mol_num + 1 , smiv_recs_.end() , smiv_recs_.begin() + mol_num );
   smiv_recs_.pop_back();
+  clear_name_index();
   mol_slider_->setMinimum( 0 );
   mol_slider_->setMaximum( int( smiv_recs_.size() - 1 ) );
+  refresh_grid();
   slot_mol_slider_changed();
 
 }
@@ -268,6 +473,8 @@ void SmiVPanel::undo_last_drop() {
   }
 
   dropped_recs_.pop_back();
+  clear_name_index();
+  refresh_grid();
   slot_mol_slider_changed();
 
 }
@@ -296,6 +503,29 @@ void SmiVPanel::write_smiles_to_stream( ostream &os ) const {
 
 }
 
+// ****************************************************************************
+void SmiVPanel::clear_name_index() {
+
+  name_index_.reset();
+  ++name_index_gen_;
+
+}
+
+// ****************************************************************************
+const SmiVNameIndex &SmiVPanel::name_index() {
+
+  if( !name_index_ && name_index_job_gen_ == name_index_gen_ ) {
+    name_index_pool_.waitForDone();
+    slot_name_index_built();
+  }
+  if( !name_index_ ) {
+    name_index_.reset( new SmiVNameIndex( smiv_recs_ ) );
+  }
+
+  return *name_index_;
+
+}
+
 // ****************************************************************************
 void SmiVPanel::go_to_first_mol() {
 
@@ -310,6 +540,31 @@ void SmiVPanel::go_to_last_mol() {
 
 }
 
+// ****************************************************************************
+bool SmiVPanel::grid_mode() const {
+
+  return disp_stack_->currentWidget() == grid_view_;
+
+}
+
+// ****************************************************************************
+void SmiVPanel::set_grid_mode( bool new_val ) {
+
+  if( new_val == grid_mode() ) {
+    return;
+  }
+
+  if( new_val ) {
+    disp_stack_->setCurrentWidget( grid_view_ );
+    refresh_grid();
+  } else {
+    disp_stack_->setCurrentWidget( mol_disp_ );
+    // it won't have been kept up to date while the grid was showing
+    slot_mol_slider_changed();
+  }
+
+}
+
 // ****************************************************************************
 void SmiVPanel::slot_mol_slider_changed() {
 
@@ -324,21 +579,25 @@ void SmiVPanel::slot_mol_slider_changed() {
   int mol_num = mol_slider_->value();
   in_smi_->setText( smiv_recs_[mol_num]->in_smi().c_str() );
   in_smi_->setCursorPosition( 0 );
-  if( smiv_recs_[mol_num]->can_smi().empty() ) {
-    smiv_recs_[mol_num]->create_can_smi();
-  }
+  // filled in by show_current_depiction() if it's not been done already
   can_smi_->setText( smiv_recs_[mol_num]->can_smi().c_str() );
   can_smi_->setCursorPosition( 0 );
 
-  scoped_ptr<OEMolBase> mol( OENewMolBase( OEMolBaseType::OEDefault ) );
-  OEParseSmiles( *mol , smiv_recs_[mol_num]->in_smi() );
-  mol->SetTitle( smiv_recs_[mol_num]->smi_name() );
-  mol_disp_->set_display_molecule( mol.get() );
-  colour_atoms();
-
   QString msg = QString( "Displaying mol %1 of %2.").arg( mol_num + 1 ).arg( smiv_recs_.size() );
   msg_->setText( msg );
 
+  if( grid_mode() ) {
+    // the grid looks after its own depictions
+    if( smiv_recs_[mol_num]->can_smi().empty() ) {
+      smiv_recs_[mol_num]->create_can_smi();
+      can_smi_->setText( smiv_recs_[mol_num]->can_smi().c_str() );
+      can_smi_->setCursorPosition( 0 );
+    }
+    grid_view_->set_current_mol( mol_num );
+  } else {
+    show_current_depiction();
+  }
+
   emit new_display_mol( QString( smiv_recs_[mol_num]->smi_name().c_str() ) );
 
 }
@@ -349,3 +608,54 @@ void SmiVPanel::slot_selection_box_changed() {
   emit( selection_box_changed( this ) );
 
 }
+
+// ****************************************************************************
+void SmiVPanel::slot_depiction_ready( pSmiVRec rec ) {
+
+  bool was_in_flight = ( rec == render_in_flight_ );
+  if( was_in_flight ) {
+    render_in_flight_.reset();
+  }
+  if( was_in_flight || rec == current_smiv_rec() ) {
+    show_current_depiction();
+  }
+
+}
+
+// ****************************************************************************
+void SmiVPanel::slot_grid_mol_selected( int mol_num ) {
+
+  mol_slider_->setValue( mol_num );
+
+}
+
+// ****************************************************************************
+void SmiVPanel::slot_grid_mol_double_clicked( int mol_num ) {
+
+  mol_slider_->setValue( mol_num );
+  set_grid_mode( false );
+
+}
+
+// ****************************************************************************
+// an index made for records that have since changed is thrown away.
+void SmiVPanel::slot_name_index_built() {
+
+  bool new_index = false;
+  {
+    QMutexLocker lock( &name_index_mutex_ );
+    if( built_name_index_ && built_name_index_gen_ == name_index_gen_ && !name_index_ ) {
+      name_index_ = built_name_index_;
+      new_index = true;
+    }
+    if( name_index_job_gen_ == built_name_index_gen_ ) {
+      name_index_job_gen_ = -1;
+    }
+    built_name_index_.reset();
+  }
+
+  if( new_index ) {
+    emit name_index_ready();
+  }
+
+}
@@ -6,27 +6,31 @@
 //
 
 #include "SmiVRecord.H"
+#include "DACOEMolAtomIndex.H"
+
+#include <algorithm>
 
 using namespace std;
 using namespace OEChem;
+using namespace OESystem;
 
 namespace DACLIB {
   void apply_daylight_aromatic_model( OEMolBase &mol );
 }
 
 // ****************************************************************************
-SmiVRecord::SmiVRecord() {
+SmiVRecord::SmiVRecord() : hits_key_( 0 ) {
 
 }
 
 // ****************************************************************************
 SmiVRecord::SmiVRecord( const string &smi , const string &smi_name ) :
-    in_smi_( smi ) , smi_name_( smi_name ) {
+    in_smi_( smi ) , smi_name_( smi_name ) , hits_key_( 0 ) {
 
 }
 
 // ****************************************************************************
-SmiVRecord::SmiVRecord( const OEMolBase &mol ) {
+SmiVRecord::SmiVRecord( const OEMolBase &mol ) : hits_key_( 0 ) {
 
   OECreateSmiString( in_smi_ , mol , OESMILESFlag::AtomStereo | OESMILESFlag::BondStereo );
   OECreateIsoSmiString( can_smi_ , mol );
@@ -48,3 +52,124 @@ void SmiVRecord::create_can_smi() {
   OECreateIsoSmiString( can_smi_ , mol );
 
 }
+
+// ****************************************************************************
+bool SmiVRecord::apply_2d_coords( const vector<float> &coords , OEMolBase &mol ) {
+
+  DACLIB::create_atom_indices( mol );
+  if( coords.empty() || coords.size() > 2 * DACLIB::max_atom_index( mol ) ) {
+    return false;
+  }
+
+  float xyz[3] = { 0.0F , 0.0F , 0.0F };
+  for( OEIter<OEAtomBase> atom = mol.GetAtoms() ; atom ; ++atom ) {
+    unsigned int ind = 2 * DACLIB::atom_index( *atom );
+    // any atom that's past the end will have been suppressed by
+    // OEPrepareDepiction, and will be again.
+    if( ind < coords.size() ) {
+      xyz[0] = coords[ind];
+      xyz[1] = coords[ind + 1];
+    } else {
+      xyz[0] = xyz[1] = 0.0F;
+    }
+    mol.SetCoords( atom , xyz );
+  }
+  mol.SetDimension( 2 );
+
+  return true;
+
+}
+
+// ****************************************************************************
+void SmiVRecord::get_2d_coords( OEMolBase &mol , vector<float> &coords ) {
+
+  coords.clear();
+  if( 2 != mol.GetDimension() ) {
+    return;
+  }
+
+  unsigned int max_ind = 0;
+  for( OEIter<OEAtomBase> atom = mol.GetAtoms() ; atom ; ++atom ) {
+    max_ind = max( max_ind , DACLIB::atom_index( *atom ) + 1 );
+  }
+  coords.resize( 2 * max_ind , 0.0F );
+
+  float xyz[3];
+  for( OEIter<OEAtomBase> atom = mol.GetAtoms() ; atom ; ++atom ) {
+    mol.GetCoords( atom , xyz );
+    unsigned int ind = 2 * DACLIB::atom_index( *atom );
+    coords[ind] = xyz[0];
+    coords[ind + 1] = xyz[1];
+  }
+
+}
+
+// ****************************************************************************
+unsigned int SmiVHitLabels::label_num( const string &label ) {
+
+  map<string,unsigned int>::iterator p = label_nums_.find( label );
+  if( p != label_nums_.end() ) {
+    return p->second;
+  }
+  labels_.push_back( label );
+  label_nums_.insert( make_pair( label , labels_.size() - 1 ) );
+  return labels_.size() - 1;
+
+}
+
+// ****************************************************************************
+void SmiVRecord::set_hits( int hits_key , const vector<unsigned int> &hit_counts ,
+                           const vector<string> &hit_labels ,
+                           const pSmiVHitLabels &label_table ) {
+
+  hits_key_ = hits_key;
+  hit_label_table_ = label_table;
+  hits_.clear();
+  for( unsigned int i = 0 , is = hit_counts.size() ; i < is ; ++i ) {
+    if( hit_counts[i] ) {
+      AtomHit hit;
+      hit.atom_ind_ = i;
+      hit.count_ = hit_counts[i];
+      hit.label_num_ = label_table->label_num( i < hit_labels.size() ? hit_labels[i] : string() );
+      hits_.push_back( hit );
+    }
+  }
+  vector<AtomHit>( hits_ ).swap( hits_ ); // no spare capacity
+
+}
+
+// ****************************************************************************
+void SmiVRecord::clear_hits() {
+
+  hits_key_ = 0;
+  vector<AtomHit>().swap( hits_ );
+  hit_label_table_.reset();
+
+}
+
+// ****************************************************************************
+void SmiVRecord::get_hits( vector<unsigned int> &hit_counts ,
+                           vector<string> &hit_labels ) const {
+
+  hit_counts.clear();
+  hit_labels.clear();
+  if( hits_.empty() ) {
+    return;
+  }
+  hit_counts.resize( hits_.back().atom_ind_ + 1 , 0 );
+  hit_labels.resize( hit_counts.size() );
+  for( int i = 0 , is = hits_.size() ; i < is ; ++i ) {
+    hit_counts[hits_[i].atom_ind_] = hits_[i].count_;
+    hit_labels[hits_[i].atom_ind_] = hit_label_table_->label( hits_[i].label_num_ );
+  }
+
+}
+
+// ****************************************************************************
+// only used in the GUI thread
+int SmiVRecord::new_hits_key() {
+
+  static int last_key = 0;
+  return ++last_key;
+
+}
@@ -0,0 +1,356 @@
+//
+// file SmiVRgroupAnalyser.cc
+//
+
+#include "SmiVRgroupAnalyser.H"
+#include "SmiVRecord.H"
+#include "SmiVSubSearches.H"
+
+#include "DACOEMolAtomIndex.H"
+#include "QTParallelFor.H"
+
+#include <algorithm>
+#include <ostream>
+
+#include <QProgressDialog>
+
+#include <oechem.h>
+
+using namespace std;
+using namespace OEChem;
+using namespace OESystem;
+
+namespace {
+
+// the molecules are decomposed this many at a time, each lot being written
+// before the next is started.
+static const int DECOMP_CHUNK = 10000;
+
+// ****************************************************************************
+// one of the bonds from the core to a substituent, after it's been cut and the
+// substituent atom bonded to a tag atom instead.
+struct RgroupTag {
+  OEAtomBase *subs_at_;
+  OEAtomBase *tag_at_;
+  int core_pos_; // of the core atom, in match order
+  bool operator<( const RgroupTag &rhs ) const {
+    return subs_at_ < rhs.subs_at_ || ( subs_at_ == rhs.subs_at_ && core_pos_ < rhs.core_pos_ );
+  }
+};
+
+// ****************************************************************************
+// The R Groups on each atom of the first match of sub in mol, in match order.
+// Returns false if there isn't a match. The first match is all that's
+// wanted, as symmetry issues aren't of interest. The molecule is copied once,
+// and each bond from the core to a substituent is replaced by one from the
+// substituent atom to a Y, so the core falls away from the R Groups, which
+// are then labelled in one go as the connected components of the copy. Each
+// atom at the end of a cut bond gives an R Group, with Xe rather than Y on
+// its own bonds to the core, which goes on each of the core atoms it's
+// bonded to.
+bool decompose_molecule( OEGraphMol &mol , OESubSearch &sub ,
+                         vector<vector<string> > &rgroups ) {
+
+  rgroups.clear();
+  OEIter<OEMatchBase> match = sub.Match( mol , true );
+  if( !match ) {
+    return false;
+  }
+  vector<unsigned int> in_core( DACLIB::max_atom_index( mol ) , 0 );
+  for( OEIter<OEAtomBase> atom = match->GetTargetAtoms() ; atom ; ++atom ) {
+    in_core[DACLIB::atom_index( *atom )] = 1;
+    rgroups.push_back( vector<string>() );
+  }
+  // the core and substituent atoms of the cut bonds, by atom index
+  vector<pair<unsigned int,unsigned int> > cut_bonds;
+  vector<int> cut_pos;
+  int i = 0;
+  for( OEIter<OEAtomBase> atom = match->GetTargetAtoms() ; atom ; ++atom , ++i ) {
+    for( OEIter<OEAtomBase> conn = atom->GetAtoms() ; conn ; ++conn ) {
+      if( !in_core[DACLIB::atom_index( *conn )] ) {
+        cut_bonds.push_back( make_pair( DACLIB::atom_index( *atom ) , DACLIB::atom_index( *conn ) ) );
+        cut_pos.push_back( i );
+      }
+    }
+  }
+  if( cut_bonds.empty() ) {
+    return true;
+  }
+
+  // the atom indices are kept by the copy, whereas GetIdx() isn't
+  OEGraphMol frag_mol( mol );
+  vector<OEAtomBase *> frag_atoms( in_core.size() , static_cast<OEAtomBase *>( 0 ) );
+  for( OEIter<OEAtomBase> atom = frag_mol.GetAtoms() ; atom ; ++atom ) {
+    frag_atoms[DACLIB::atom_index( *atom )] = atom;
+  }
+  vector<RgroupTag> tags( cut_bonds.size() );
+  for( int j = 0 , js = cut_bonds.size() ; j < js ; ++j ) {
+    OEAtomBase *core_at = frag_atoms[cut_bonds[j].first];
+    tags[j].subs_at_ = frag_atoms[cut_bonds[j].second];
+    tags[j].core_pos_ = cut_pos[j];
+    OEBondBase *bond = frag_mol.GetBond( core_at , tags[j].subs_at_ );
+    unsigned int bond_order = bond->GetOrder();
+    frag_mol.DeleteBond( bond );
+    tags[j].tag_at_ = frag_mol.NewAtom( OEElemNo::Y );
+    frag_mol.NewBond( tags[j].tag_at_ , tags[j].subs_at_ , bond_order );
+  }
+  // so the tags for each substituent atom are together
+  sort( tags.begin() , tags.end() );
+
+  vector<unsigned int> parts( frag_mol.GetMaxAtomIdx() , 0 );
+  OEDetermineComponents( frag_mol , &parts[0] );
+  OEPartPredAtom part_pred( &parts[0] );
+  for( int j = 0 , js = tags.size() ; j < js ; ) {
+    int k = j;
+    for( ; k < js && tags[k].subs_at_ == tags[j].subs_at_ ; ++k ) {
+      tags[k].tag_at_->SetAtomicNum( OEElemNo::Xe );
+    }
+    part_pred.SelectPart( parts[tags[j].subs_at_->GetIdx()] );
+    OEGraphMol rgroup_mol;
+    OESubsetMol( rgroup_mol , frag_mol , part_pred );
+    string rgroup_smi;
+    OECreateCanSmiString( rgroup_smi , rgroup_mol );
+    for( ; j < k ; ++j ) {
+      tags[j].tag_at_->SetAtomicNum( OEElemNo::Y );
+      rgroups[tags[j].core_pos_].push_back( rgroup_smi );
+    }
+  }
+
+  return true;
+
+}
+
+// ****************************************************************************
+// add the positions of the core atoms with substituents, and the R Groups on
+// them, to those already found.
+void rgroup_counts_and_strip( OEGraphMol &mol , OESubSearch &sub ,
+                              set<int> &rgroup_pos , boost::unordered_set<string> &unique_rgroups ) {
+
+  vector<vector<string> > rgroups;
+  decompose_molecule( mol , sub , rgroups );
+  for( int i = 0 , is = rgroups.size() ; i < is ; ++i ) {
+    if( !rgroups[i].empty() ) {
+      rgroup_pos.insert( i );
+      unique_rgroups.insert( rgroups[i].begin() , rgroups[i].end() );
+    }
+  }
+
+}
+
+// ****************************************************************************
+// quoted if it has to be, with any quotes in it doubled, as
+// SmivDataTable::read_data_from_file expects.
+void write_csv_field( const string &field , ostream &os ) {
+
+  if( string::npos == field.find_first_of( ",\"\r\n" ) ) {
+    os << field;
+    return;
+  }
+  os << '"';
+  for( size_t i = 0 , is = field.length() ; i < is ; ++i ) {
+    if( '"' == field[i] ) {
+      os << '"';
+    }
+    os << field[i];
+  }
+  os << '"';
+
+}
+
+// ****************************************************************************
+// Does one molecule at a time, in whichever thread DACLIB::parallel_for puts
+// it. Each thread has its own copies of the searches and its own results.
+class SmiVRgroupWorker {
+public :
+  SmiVRgroupWorker( const vector<pSmiVRec> &recs ,
+                    const SmiVSubSearches &cores ) :
+    recs_( recs ) , subs_( DACLIB::num_parallel_workers() ) ,
+    rgroup_pos_( DACLIB::num_parallel_workers() , vector<set<int> >( cores.size() ) ) ,
+    unique_rgroups_( DACLIB::num_parallel_workers() , vector<boost::unordered_set<string> >( cores.size() ) ) ,
+    core_counts_( DACLIB::num_parallel_workers() , vector<int>( cores.size() , 0 ) ) {
+    for( int i = 0 , is = subs_.size() ; i < is ; ++i ) {
+      subs_[i] = copy_sub_searches( cores );
+    }
+  }
+
+  void operator()( int rec_num , int worker_num ) {
+    OEGraphMol mol;
+    OEParseSmiles( mol , recs_[rec_num]->in_smi() );
+    bool core_mol( recs_[rec_num]->smi_name().substr( 0 , 4 ) == string( "core" ) );
+    SmiVSubSearches &subs = subs_[worker_num];
+    for( int i = 0 , is = subs.size() ; i < is ; ++i ) {
+      if( core_mol ) {
+        // when molecule and subsearch are both cores, count whether mol contains sub
+        if( subs[i].first->SingleMatch( mol ) ) {
+          ++core_counts_[worker_num][i];
+        }
+      } else {
+        rgroup_counts_and_strip( mol , *subs[i].first , rgroup_pos_[worker_num][i] ,
+                                 unique_rgroups_[worker_num][i] );
+      }
+    }
+  }
+
+  // put all the threads' results together, emptying them as it goes
+  void merge( vector<set<int> > &rgroup_pos , vector<boost::unordered_set<string> > &unique_rgroups ,
+              vector<int> &core_counts ) {
+    rgroup_pos.swap( rgroup_pos_.front() );
+    unique_rgroups.swap( unique_rgroups_.front() );
+    core_counts.swap( core_counts_.front() );
+    for( int i = 1 , is = rgroup_pos_.size() ; i < is ; ++i ) {
+      for( int j = 0 , js = rgroup_pos.size() ; j < js ; ++j ) {
+        rgroup_pos[j].insert( rgroup_pos_[i][j].begin() , rgroup_pos_[i][j].end() );
+        set<int>().swap( rgroup_pos_[i][j] );
+        unique_rgroups[j].insert( unique_rgroups_[i][j].begin() , unique_rgroups_[i][j].end() );
+        boost::unordered_set<string>().swap( unique_rgroups_[i][j] );
+        core_counts[j] += core_counts_[i][j];
+      }
+    }
+  }
+
+private :
+  const vector<pSmiVRec> &recs_;
+  vector<SmiVSubSearches> subs_;
+  vector<vector<set<int> > > rgroup_pos_;
+  vector<vector<boost::unordered_set<string> > > unique_rgroups_;
+  vector<vector<int> > core_counts_;
+};
+
+// ****************************************************************************
+// Decomposes a chunk of molecules by a single core, in whichever thread
+// DACLIB::parallel_for puts them, into a row for each, which is left empty if
+// the core isn't in it. Each thread has its own copy of the search.
+class SmiVRgroupDecomposer {
+public :
+  SmiVRgroupDecomposer( const vector<pSmiVRec> &recs ,
+                        const SmiVSubSearches::value_type &core ) :
+    recs_( recs ) , subs_( DACLIB::num_parallel_workers() ) , chunk_start_( 0 ) {
+    for( int i = 0 , is = subs_.size() ; i < is ; ++i ) {
+      subs_[i] = copy_sub_searches( SmiVSubSearches( 1 , core ) );
+    }
+  }
+
+  void set_chunk( int chunk_start , int chunk_size ) {
+    chunk_start_ = chunk_start;
+    rows_.clear();
+    rows_.resize( chunk_size );
+  }
+  // each row has the R Groups on each core atom, with dots between them if
+  // there's more than one.
+  const vector<vector<string> > &rows() const { return rows_; }
+
+  void operator()( int row_num , int worker_num ) {
+    const pSmiVRec &rec = recs_[chunk_start_ + row_num];
+    if( rec->smi_name().substr( 0 , 4 ) == string( "core" ) ) {
+      return;
+    }
+    OEGraphMol mol;
+    OEParseSmiles( mol , rec->in_smi() );
+    vector<vector<string> > rgroups;
+    if( !decompose_molecule( mol , *subs_[worker_num].front().first , rgroups ) ) {
+      return;
+    }
+    vector<string> &row = rows_[row_num];
+    row.resize( rgroups.size() );
+    for( int i = 0 , is = rgroups.size() ; i < is ; ++i ) {
+      sort( rgroups[i].begin() , rgroups[i].end() );
+      for( int j = 0 , js = rgroups[i].size() ; j < js ; ++j ) {
+        if( j ) {
+          row[i] += ".";
+        }
+        row[i] += rgroups[i][j];
+      }
+    }
+  }
+
+private :
+  const vector<pSmiVRec> &recs_;
+  vector<SmiVSubSearches> subs_;
+  int chunk_start_;
+  vector<vector<string> > rows_;
+};
+
+} // EO anonymous namespace
+
+// ****************************************************************************
+SmiVRgroupAnalyser::SmiVRgroupAnalyser( const SmiVSubSearches &sub_searches ) {
+
+  for( int i = 0 , is = sub_searches.size() ; i < is ; ++i ) {
+    if( sub_searches[i].second.substr( 0 , 4 ) == string( "core" ) ) {
+      cores_.push_back( sub_searches[i] );
+    }
+  }
+
+}
+
+// ****************************************************************************
+bool SmiVRgroupAnalyser::analyse( const vector<pSmiVRec> &recs , QWidget *parent ) {
+
+  rgroup_pos_.clear();
+  unique_rgroups_.clear();
+  core_counts_.clear();
+
+  SmiVRgroupWorker worker( recs , cores_ );
+  if( !DACLIB::parallel_for( worker , recs.size() , parent ,
+                             QString( "R Group analysis of %1 molecules with %2 cores." )
+                             .arg( recs.size() ).arg( cores_.size() ) ) ) {
+    return false;
+  }
+  worker.merge( rgroup_pos_ , unique_rgroups_ , core_counts_ );
+
+  return true;
+
+}
+
+// ****************************************************************************
+// The header goes out with the first row, as that's when the number of core
+// atoms is known. Only DECOMP_CHUNK rows are kept at any time, so it doesn't
+// matter how many molecules there are.
+bool SmiVRgroupAnalyser::decompose( const vector<pSmiVRec> &recs , int core_num ,
+                                    ostream &os , int &num_rows , QWidget *parent ) {
+
+  num_rows = 0;
+  SmiVRgroupDecomposer decomposer( recs , cores_[core_num] );
+
+  QProgressDialog progress( QString( "R Group decomposition of %1 molecules by %2." )
+                            .arg( recs.size() ).arg( cores_[core_num].second.c_str() ) ,
+                            "Cancel" , 0 , recs.size() , parent );
+  progress.setWindowModality( Qt::WindowModal );
+  progress.setMinimumDuration( 500 );
+
+  bool header_done = false;
+  for( int i = 0 , is = recs.size() ; i < is ; i += DECOMP_CHUNK ) {
+    int chunk_size = min( DECOMP_CHUNK , is - i );
+    decomposer.set_chunk( i , chunk_size );
+    if( !DACLIB::parallel_for( decomposer , chunk_size , &progress , i ) ) {
+      return false;
+    }
+
+    const vector<vector<string> > &rows = decomposer.rows();
+    for( int j = 0 ; j < chunk_size ; ++j ) {
+      if( rows[j].empty() ) {
+        continue;
+      }
+      if( !header_done ) {
+        os << "Name";
+        for( int k = 0 , ks = rows[j].size() ; k < ks ; ++k ) {
+          os << ",R" << k + 1;
+        }
+        os << "\n";
+        header_done = true;
+      }
+      write_csv_field( recs[i + j]->smi_name() , os );
+      for( int k = 0 , ks = rows[j].size() ; k < ks ; ++k ) {
+        os << ",";
+        write_csv_field( rows[j][k] , os );
+      }
+      os << "\n";
+      ++num_rows;
+    }
+    os.flush();
+  }
+  progress.setValue( recs.size() );
+
+  return true;
+
+}
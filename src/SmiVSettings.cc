@@ -16,7 +16,9 @@ using namespace std;
 namespace po = boost::program_options;
 
 // *****************************************************************************
-SmiVSettings::SmiVSettings( int argc , char **argv ) {
+SmiVSettings::SmiVSettings( int argc , char **argv ) :
+  export_format_( "png" ) , export_width_( 400 ) , export_height_( 300 ) ,
+  export_grid_rows_( 0 ) , export_grid_cols_( 0 ) {
 
   po::options_description desc( "Allowed Options" );
   build_program_options( desc );
@@ -62,7 +64,19 @@ void SmiVSettings::build_program_options( po::options_description &desc ) {
     ( "smarts-file,S" , po::value<string>( &smarts_file_ ) ,
       "Input SMARTS filename" )
     ( "data-file,D" , po::value<string>( &data_file_ ) ,
-      "Arbitrary data filename" );
+      "Arbitrary data filename" )
+    ( "export-dir" , po::value<string>( &export_dir_ ) ,
+      "Write pictures of the molecules into this directory and exit, without the GUI. If there's a SMARTS or MDL query file, only the molecules that match any of the queries are written, with the matches highlighted." )
+    ( "export-format" , po::value<string>( &export_format_ ) ,
+      "File format for --export-dir, e.g. png, svg, pdf (default png)" )
+    ( "export-width" , po::value<int>( &export_width_ ) ,
+      "Width of each exported molecule (default 400)" )
+    ( "export-height" , po::value<int>( &export_height_ ) ,
+      "Height of each exported molecule (default 300)" )
+    ( "export-grid-rows" , po::value<int>( &export_grid_rows_ ) ,
+      "Number of rows of molecules on each exported page (default 0, for 1 molecule per file)" )
+    ( "export-grid-cols" , po::value<int>( &export_grid_cols_ ) ,
+      "Number of columns of molecules on each exported page (default 0, for 1 molecule per file)" );
 
 }
 
@@ -0,0 +1,24 @@
+//
+// file SmiVSubSearches.cc
+//
+
+#include "SmiVSubSearches.H"
+
+#include <oechem.h>
+
+using namespace std;
+using namespace OEChem;
+
+// ****************************************************************************
+SmiVSubSearches copy_sub_searches( const SmiVSubSearches &sub_searches ) {
+
+  SmiVSubSearches copies;
+  copies.reserve( sub_searches.size() );
+  for( int i = 0 , is = sub_searches.size() ; i < is ; ++i ) {
+    copies.push_back( make_pair( boost::shared_ptr<OESubSearch>( new OESubSearch( *sub_searches[i].first ) ) ,
+                                 sub_searches[i].second ) );
+  }
+
+  return copies;
+
+}
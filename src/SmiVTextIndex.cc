@@ -0,0 +1,266 @@
+//
+// file SmiVTextIndex.cc
+//
+
+#include "SmiVTextIndex.H"
+
+#include <algorithm>
+
+#include <cctype>
+
+#include <boost/regex.hpp>
+
+using namespace std;
+
+namespace {
+
+// ****************************************************************************
+void end_run( string &run , vector<string> &literals ) {
+
+  if( run.length() >= 3 ) {
+    literals.push_back( run );
+  }
+  run.clear();
+
+}
+
+// ****************************************************************************
+// the position of the ] that closes the character class starting at pos.
+size_t end_of_char_class( const string &pattern , size_t pos ) {
+
+  size_t i = pos + 1;
+  if( i < pattern.length() && '^' == pattern[i] ) {
+    ++i;
+  }
+  if( i < pattern.length() && ']' == pattern[i] ) {
+    ++i; // a ] straight after the [ is part of the class
+  }
+  while( i < pattern.length() ) {
+    if( '\\' == pattern[i] ) {
+      i += 2;
+    } else if( '[' == pattern[i] && i + 1 < pattern.length() && ':' == pattern[i + 1] ) {
+      size_t close = pattern.find( ":]" , i + 2 );
+      i = string::npos == close ? pattern.length() : close + 2;
+    } else if( ']' == pattern[i] ) {
+      return i;
+    } else {
+      ++i;
+    }
+  }
+  return pattern.length();
+
+}
+
+} // EO anonymous namespace
+
+// ****************************************************************************
+SmiVTextIndex::SmiVTextIndex() {
+
+}
+
+// ****************************************************************************
+void SmiVTextIndex::set_texts( vector<string> &texts ) {
+
+  texts_.swap( texts );
+  vector<string>().swap( texts );
+  trigrams_.clear();
+
+  // going through the strings in order keeps each list of positions sorted.
+  for( int i = 0 , is = texts_.size() ; i < is ; ++i ) {
+    for( size_t j = 0 ; j + 3 <= texts_[i].length() ; ++j ) {
+      vector<int> &posns = trigrams_[trigram( texts_[i] , j )];
+      if( posns.empty() || posns.back() != i ) {
+        posns.push_back( i );
+      }
+    }
+  }
+
+}
+
+// ****************************************************************************
+int SmiVTextIndex::find_next( const string &str , int start_pos ) const {
+
+  const vector<int> *cands = candidates( vector<string>( 1 , str ) );
+  if( !cands ) {
+    // too short to narrow it down, and likely to be in lots of them anyway
+    for( int i = start_pos + 1 , is = texts_.size() ; i < is ; ++i ) {
+      if( string::npos != texts_[i].find( str ) ) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  for( vector<int>::const_iterator p = upper_bound( cands->begin() , cands->end() , start_pos ) ,
+       ps = cands->end() ; p != ps ; ++p ) {
+    if( string::npos != texts_[*p].find( str ) ) {
+      return *p;
+    }
+  }
+  return -1;
+
+}
+
+// ****************************************************************************
+void SmiVTextIndex::find_all( const string &str , vector<int> &hits ) const {
+
+  hits.clear();
+  const vector<int> *cands = candidates( vector<string>( 1 , str ) );
+  if( !cands ) {
+    for( int i = 0 , is = texts_.size() ; i < is ; ++i ) {
+      if( string::npos != texts_[i].find( str ) ) {
+        hits.push_back( i );
+      }
+    }
+    return;
+  }
+
+  for( int i = 0 , is = cands->size() ; i < is ; ++i ) {
+    if( string::npos != texts_[(*cands)[i]].find( str ) ) {
+      hits.push_back( (*cands)[i] );
+    }
+  }
+
+}
+
+// ****************************************************************************
+void SmiVTextIndex::find_all_regex( const string &pattern , vector<int> &hits ) const {
+
+  hits.clear();
+  boost::regex re( pattern );
+  vector<string> literals;
+  regex_literals( pattern , literals );
+  const vector<int> *cands = candidates( literals );
+  if( !cands ) {
+    for( int i = 0 , is = texts_.size() ; i < is ; ++i ) {
+      if( boost::regex_search( texts_[i] , re ) ) {
+        hits.push_back( i );
+      }
+    }
+    return;
+  }
+
+  for( int i = 0 , is = cands->size() ; i < is ; ++i ) {
+    if( boost::regex_search( texts_[(*cands)[i]] , re ) ) {
+      hits.push_back( (*cands)[i] );
+    }
+  }
+
+}
+
+// ****************************************************************************
+// Only runs of plain characters outside groups are used, and a character
+// followed by *, ? or {} is left off its run. If there's anything that could
+// make the runs optional, such as alternatives, or change how they match,
+// such as (?i) or \Q, there aren't any runs at all.
+void SmiVTextIndex::regex_literals( const string &pattern , vector<string> &literals ) {
+
+  literals.clear();
+  for( size_t i = 0 , is = pattern.length() ; i < is ; ++i ) {
+    if( '\\' == pattern[i] ) {
+      if( i + 1 < is && 'Q' == pattern[i + 1] ) {
+        return;
+      }
+      ++i;
+    } else if( '|' == pattern[i] || ( '(' == pattern[i] && i + 1 < is && '?' == pattern[i + 1] ) ) {
+      return;
+    }
+  }
+
+  string run;
+  int depth = 0;
+  bool last_lit = false; // the last character of run is the one a quantifier would apply to
+  for( size_t i = 0 , is = pattern.length() ; i < is ; ) {
+    char c = pattern[i];
+    if( '*' == c || '?' == c || '{' == c ) {
+      // the thing before might not be there at all
+      if( last_lit ) {
+        run.erase( run.length() - 1 );
+      }
+      end_run( run , literals );
+      last_lit = false;
+      if( '{' == c ) {
+        size_t close = pattern.find( '}' , i );
+        i = string::npos == close ? is : close + 1;
+      } else {
+        ++i;
+      }
+      continue;
+    }
+
+    last_lit = false;
+    if( '+' == c ) {
+      // the thing before is there at least once, but maybe more
+      end_run( run , literals );
+      ++i;
+    } else if( '\\' == c ) {
+      if( i + 1 < is && !isalnum( (unsigned char) pattern[i + 1] ) ) {
+        if( !depth ) {
+          run += pattern[i + 1];
+          last_lit = true;
+        }
+        i += 2;
+      } else {
+        // \d, \x41, \p{L} and so on. The characters after them might not be
+        // their own, so they're skipped as well.
+        end_run( run , literals );
+        i += 2;
+        while( i < is && ( isalnum( (unsigned char) pattern[i] ) || '{' == pattern[i] ) ) {
+          if( '{' == pattern[i] ) {
+            size_t close = pattern.find( '}' , i );
+            i = string::npos == close ? is : close;
+          }
+          ++i;
+        }
+      }
+    } else if( '[' == c ) {
+      end_run( run , literals );
+      i = end_of_char_class( pattern , i ) + 1;
+    } else if( '(' == c || ')' == c ) {
+      end_run( run , literals );
+      depth += '(' == c ? 1 : -1;
+      ++i;
+    } else if( '.' == c || '^' == c || '$' == c ) {
+      end_run( run , literals );
+      ++i;
+    } else {
+      if( !depth ) {
+        run += c;
+        last_lit = true;
+      }
+      ++i;
+    }
+  }
+  end_run( run , literals );
+
+}
+
+// ****************************************************************************
+const vector<int> *SmiVTextIndex::candidates( const vector<string> &strs ) const {
+
+  const vector<int> *rarest = 0;
+  for( int i = 0 , is = strs.size() ; i < is ; ++i ) {
+    for( size_t j = 0 ; j + 3 <= strs[i].length() ; ++j ) {
+      boost::unordered_map<unsigned int , vector<int> >::const_iterator p =
+          trigrams_.find( trigram( strs[i] , j ) );
+      if( p == trigrams_.end() ) {
+        return &no_texts_;
+      }
+      if( !rarest || p->second.size() < rarest->size() ) {
+        rarest = &p->second;
+      }
+    }
+  }
+
+  return rarest;
+
+}
+
+// ****************************************************************************
+unsigned int SmiVTextIndex::trigram( const string &str , size_t i ) {
+
+  return ( (unsigned int)( (unsigned char) str[i] ) << 16 ) |
+      ( (unsigned int)( (unsigned char) str[i + 1] ) << 8 ) |
+      (unsigned int)( (unsigned char) str[i + 2] );
+
+}
@@ -0,0 +1,428 @@
+//
+// file SmivDataColumn.cc
+//
+
+#include "SmivDataColumn.H"
+
+#include <algorithm>
+#include <limits>
+
+#include <cstring>
+
+#include <QByteArray>
+
+using namespace std;
+
+namespace {
+
+// ****************************************************************************
+// Only integers that would be written back the same way count, so things
+// like registry numbers with leading zeros stay as strings. The characters
+// needn't be null-terminated.
+bool parse_int( const char *str , int len , qint64 &val ) {
+
+  const char *p = str , *e = str + len;
+  bool neg = p < e && '-' == *p;
+  if( neg ) {
+    ++p;
+  }
+  if( p == e || ( '0' == *p && ( e - p > 1 || neg ) ) ) {
+    return false;
+  }
+
+  const quint64 max_val = neg ? quint64( numeric_limits<qint64>::max() ) + 1 :
+                                quint64( numeric_limits<qint64>::max() );
+  quint64 v = 0;
+  for( ; p < e ; ++p ) {
+    if( *p < '0' || *p > '9' ) {
+      return false;
+    }
+    quint64 d = *p - '0';
+    if( v > ( max_val - d ) / 10 ) {
+      return false;
+    }
+    v = 10 * v + d;
+  }
+
+  val = neg ? qint64( 0 - v ) : qint64( v );
+  return true;
+
+}
+
+// ****************************************************************************
+// always in the C locale, as QString::toDouble was.
+bool parse_double( const char *str , int len , double &val ) {
+
+  if( !len ) {
+    return false;
+  }
+  bool ok = false;
+  val = QByteArray::fromRawData( str , len ).toDouble( &ok );
+  return ok;
+
+}
+
+// ****************************************************************************
+// The precision for %g that gives the mantissa of str back, which is the
+// number of digits from the first non-zero one.
+int g_precision( const char *str , int len ) {
+
+  int prec = 0;
+  for( int i = 0 ; i < len && 'e' != str[i] && 'E' != str[i] ; ++i ) {
+    if( prec || ( str[i] >= '1' && str[i] <= '9' ) ) {
+      prec += ( str[i] >= '0' && str[i] <= '9' );
+    }
+  }
+  return max( 1 , min( 17 , prec ) );
+
+}
+
+// ****************************************************************************
+QByteArray double_text( double val , int prec ) {
+
+  return QByteArray::number( val , 'g' , prec );
+
+}
+
+// ****************************************************************************
+// As for parse_int, only numbers that are written back the same way count,
+// so 1.50 or 1e5 stay as strings. prec is what's needed for double_text.
+bool parse_exact_double( const char *str , int len , double &val , quint8 &prec ) {
+
+  if( !parse_double( str , len , val ) ) {
+    return false;
+  }
+  prec = g_precision( str , len );
+  return double_text( val , prec ) == QByteArray::fromRawData( str , len );
+
+}
+
+// ****************************************************************************
+// LSD radix sort of rows by keys, which is indexed by row number, 16 bits at a
+// time. Passes where all the rows have the same digit, such as the high bits
+// of most integers, are skipped.
+void radix_sort_rows( const vector<quint64> &keys , vector<int> &rows ) {
+
+  vector<int> sorted_rows( rows.size() );
+  vector<int> counts( 65537 );
+  for( int shift = 0 ; shift < 64 ; shift += 16 ) {
+    fill( counts.begin() , counts.end() , 0 );
+    for( int i = 0 , is = rows.size() ; i < is ; ++i ) {
+      ++counts[( ( keys[rows[i]] >> shift ) & 0xFFFF ) + 1];
+    }
+    if( rows.empty() || int( rows.size() ) == counts[( ( keys[rows[0]] >> shift ) & 0xFFFF ) + 1] ) {
+      continue;
+    }
+    for( int i = 1 ; i < 65537 ; ++i ) {
+      counts[i] += counts[i - 1];
+    }
+    for( int i = 0 , is = rows.size() ; i < is ; ++i ) {
+      sorted_rows[counts[( keys[rows[i]] >> shift ) & 0xFFFF]++] = rows[i];
+    }
+    rows.swap( sorted_rows );
+  }
+
+}
+
+// ****************************************************************************
+// the bits of the numbers rearranged so they sort the same way as unsigned
+// integers.
+quint64 int_sort_key( qint64 val ) {
+
+  return quint64( val ) ^ ( quint64( 1 ) << 63 );
+
+}
+
+// ****************************************************************************
+quint64 double_sort_key( double val ) {
+
+  if( 0.0 == val ) {
+    val = 0.0; // so -0.0 is the same as 0.0
+  }
+  quint64 bits;
+  memcpy( &bits , &val , sizeof( bits ) );
+  return ( bits & ( quint64( 1 ) << 63 ) ) ? ~bits : bits ^ ( quint64( 1 ) << 63 );
+
+}
+
+// ****************************************************************************
+class DictLess {
+public :
+  DictLess( const vector<QString> &dict ) : dict_( dict ) {}
+  bool operator()( int lhs , int rhs ) const {
+    return dict_[lhs] < dict_[rhs];
+  }
+private :
+  const vector<QString> &dict_;
+};
+
+} // EO anonymous namespace
+
+// ****************************************************************************
+SmivDataColumn::SmivDataColumn() :
+  type_( INT_COL ) , num_ranks_( 0 ) , ranks_valid_( false ) {
+
+}
+
+// ****************************************************************************
+void SmivDataColumn::set_values( const vector<Field> &vals , bool infer_type ) {
+
+  type_ = INT_COL;
+  vector<bool>().swap( nulls_ );
+  vector<qint64>().swap( ints_ );
+  vector<double>().swap( doubles_ );
+  vector<quint8>().swap( precs_ );
+  vector<int>().swap( codes_ );
+  vector<QString>().swap( dict_ );
+  dict_codes_.clear();
+
+  append_values( vals , infer_type );
+
+}
+
+// ****************************************************************************
+void SmivDataColumn::append_values( const vector<Field> &vals , bool infer_type ) {
+
+  // the most specific type that all the values, old and new, will go into
+  ColType new_type = infer_type ? type_ : STRING_COL;
+  qint64 ival;
+  double dval;
+  quint8 prec;
+  for( int i = 0 , is = vals.size() ; i < is && STRING_COL != new_type ; ++i ) {
+    const Field &f = vals[i];
+    if( !f.second ) {
+      continue;
+    }
+    if( INT_COL == new_type && !parse_int( f.first , f.second , ival ) ) {
+      new_type = parse_exact_double( f.first , f.second , dval , prec ) ? DOUBLE_COL : STRING_COL;
+      // the integers before it have to be exact as doubles as well
+      i = -1;
+    } else if( DOUBLE_COL == new_type && !parse_exact_double( f.first , f.second , dval , prec ) ) {
+      new_type = STRING_COL;
+    }
+  }
+  if( nulls_.empty() ) {
+    type_ = new_type;
+  } else {
+    promote( new_type );
+  }
+
+  int start = size();
+  int new_size = start + vals.size();
+  nulls_.resize( new_size , false );
+  ranks_valid_ = false;
+  switch( type_ ) {
+  case INT_COL : ints_.resize( new_size , 0 ); break;
+  case DOUBLE_COL : doubles_.resize( new_size , 0.0 ); precs_.resize( new_size , 1 ); break;
+  case STRING_COL : codes_.resize( new_size , 0 ); break;
+  }
+
+  for( int i = 0 , is = vals.size() ; i < is ; ++i ) {
+    const Field &f = vals[i];
+    int row = start + i;
+    if( !f.second ) {
+      nulls_[row] = true;
+      if( STRING_COL == type_ ) {
+        codes_[row] = string_code( QString() );
+      }
+      continue;
+    }
+    switch( type_ ) {
+    case INT_COL : parse_int( f.first , f.second , ints_[row] ); break;
+    case DOUBLE_COL : parse_exact_double( f.first , f.second , doubles_[row] , precs_[row] ); break;
+    case STRING_COL : codes_[row] = string_code( QString::fromLocal8Bit( f.first , f.second ) ); break;
+    }
+  }
+
+}
+
+// ****************************************************************************
+QVariant SmivDataColumn::value( int row ) const {
+
+  if( nulls_[row] ) {
+    return QVariant();
+  }
+
+  switch( type_ ) {
+  case INT_COL : return QVariant( ints_[row] );
+  case DOUBLE_COL : return QVariant( doubles_[row] );
+  case STRING_COL : return QVariant( dict_[codes_[row]] );
+  }
+
+  return QVariant();
+
+}
+
+// ****************************************************************************
+QString SmivDataColumn::text( int row ) const {
+
+  if( nulls_[row] ) {
+    return QString();
+  }
+
+  switch( type_ ) {
+  case INT_COL : return QString::number( ints_[row] );
+  case DOUBLE_COL : return QString::fromLatin1( double_text( doubles_[row] , precs_[row] ) );
+  case STRING_COL : return dict_[codes_[row]];
+  }
+
+  return QString();
+
+}
+
+// ****************************************************************************
+void SmivDataColumn::set_value( int row , const QVariant &new_val ) {
+
+  ranks_valid_ = false;
+  QString new_str = new_val.toString();
+  if( new_str.isEmpty() ) {
+    nulls_[row] = true;
+    return;
+  }
+
+  QByteArray s( new_str.toLocal8Bit() );
+  qint64 ival;
+  double dval;
+  quint8 prec;
+  if( INT_COL == type_ && !parse_int( s.constData() , s.length() , ival ) ) {
+    promote( parse_exact_double( s.constData() , s.length() , dval , prec ) ? DOUBLE_COL : STRING_COL );
+  }
+  if( DOUBLE_COL == type_ && !parse_exact_double( s.constData() , s.length() , dval , prec ) ) {
+    promote( STRING_COL );
+  }
+
+  nulls_[row] = false;
+  switch( type_ ) {
+  case INT_COL : parse_int( s.constData() , s.length() , ints_[row] ); break;
+  case DOUBLE_COL : parse_exact_double( s.constData() , s.length() , doubles_[row] , precs_[row] ); break;
+  case STRING_COL : codes_[row] = string_code( new_str ); break;
+  }
+
+}
+
+// ****************************************************************************
+const vector<int> &SmivDataColumn::ranks() const {
+
+  if( !ranks_valid_ ) {
+    make_ranks();
+  }
+  return ranks_;
+
+}
+
+// ****************************************************************************
+int SmivDataColumn::num_ranks() const {
+
+  if( !ranks_valid_ ) {
+    make_ranks();
+  }
+  return num_ranks_;
+
+}
+
+// ****************************************************************************
+void SmivDataColumn::make_ranks() const {
+
+  ranks_.resize( size() );
+  vector<int> rows;
+  rows.reserve( size() );
+  for( int i = 0 , is = size() ; i < is ; ++i ) {
+    // NaNs don't compare, so they go in with the nulls
+    if( !nulls_[i] && !( DOUBLE_COL == type_ && doubles_[i] != doubles_[i] ) ) {
+      rows.push_back( i );
+    }
+  }
+
+  if( STRING_COL == type_ ) {
+    // sort the dictionary, which is usually much smaller than the column,
+    // and rank the rows by their string's place in it.
+    vector<int> dict_order( dict_.size() );
+    for( int i = 0 , is = dict_order.size() ; i < is ; ++i ) {
+      dict_order[i] = i;
+    }
+    sort( dict_order.begin() , dict_order.end() , DictLess( dict_ ) );
+    vector<int> code_ranks( dict_.size() );
+    num_ranks_ = 0;
+    for( int i = 0 , is = dict_order.size() ; i < is ; ++i ) {
+      // the empty string is only there for nulls
+      if( !dict_[dict_order[i]].isEmpty() ) {
+        code_ranks[dict_order[i]] = num_ranks_++;
+      }
+    }
+    for( int i = 0 , is = rows.size() ; i < is ; ++i ) {
+      ranks_[rows[i]] = code_ranks[codes_[rows[i]]];
+    }
+  } else {
+    vector<quint64> keys( size() , 0 );
+    for( int i = 0 , is = rows.size() ; i < is ; ++i ) {
+      keys[rows[i]] = INT_COL == type_ ? int_sort_key( ints_[rows[i]] ) :
+                                         double_sort_key( doubles_[rows[i]] );
+    }
+    radix_sort_rows( keys , rows );
+    num_ranks_ = 0;
+    for( int i = 0 , is = rows.size() ; i < is ; ++i ) {
+      if( i && keys[rows[i]] != keys[rows[i - 1]] ) {
+        ++num_ranks_;
+      }
+      ranks_[rows[i]] = num_ranks_;
+    }
+    if( !rows.empty() ) {
+      ++num_ranks_;
+    }
+  }
+
+  for( int i = 0 , is = size() ; i < is ; ++i ) {
+    if( nulls_[i] || ( DOUBLE_COL == type_ && doubles_[i] != doubles_[i] ) ) {
+      ranks_[i] = num_ranks_;
+    }
+  }
+  ranks_valid_ = true;
+
+}
+
+// ****************************************************************************
+int SmivDataColumn::string_code( const QString &str ) {
+
+  QHash<QString,int>::const_iterator p = dict_codes_.find( str );
+  if( p != dict_codes_.end() ) {
+    return p.value();
+  }
+  dict_.push_back( str );
+  dict_codes_.insert( str , dict_.size() - 1 );
+  return dict_.size() - 1;
+
+}
+
+// ****************************************************************************
+void SmivDataColumn::promote( ColType new_type ) {
+
+  if( new_type <= type_ ) {
+    return;
+  }
+
+  if( DOUBLE_COL == new_type ) {
+    // integers too long to be written back from a double need strings
+    doubles_.resize( size() );
+    precs_.resize( size() );
+    for( int i = 0 , is = size() ; i < is ; ++i ) {
+      QByteArray s( QByteArray::number( ints_[i] ) );
+      if( !nulls_[i] && !parse_exact_double( s.constData() , s.length() , doubles_[i] , precs_[i] ) ) {
+        vector<double>().swap( doubles_ );
+        vector<quint8>().swap( precs_ );
+        promote( STRING_COL );
+        return;
+      }
+    }
+  } else {
+    // so the strings look like they do in the table.
+    codes_.resize( size() );
+    for( int i = 0 , is = size() ; i < is ; ++i ) {
+      codes_[i] = string_code( text( i ) );
+    }
+    vector<double>().swap( doubles_ );
+    vector<quint8>().swap( precs_ );
+  }
+  vector<qint64>().swap( ints_ );
+  type_ = new_type;
+
+}
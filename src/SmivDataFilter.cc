@@ -0,0 +1,438 @@
+//
+// file SmivDataFilter.cc
+//
+
+#include "SmivDataFilter.H"
+#include "SmivDataTable.H"
+
+#include <algorithm>
+
+using namespace std;
+
+// *****************************************************************************************
+SmivDataFilter::SmivDataFilter( const SmivDataTable &table ) :
+  table_( table ) , next_tok_( 0 ) {
+
+}
+
+// *****************************************************************************************
+bool SmivDataFilter::parse( const QString &expr ) {
+
+  root_.reset();
+  error_.clear();
+  if( !tokenise( expr ) ) {
+    return false;
+  }
+
+  next_tok_ = 0;
+  root_ = parse_or();
+  if( root_ && END_TOK != tokens_[next_tok_].type_ ) {
+    error_ = QString( "Didn't expect %1 there." ).arg( tokens_[next_tok_].text_ );
+    root_.reset();
+  }
+
+  return bool( root_ );
+
+}
+
+// *****************************************************************************************
+void SmivDataFilter::evaluate( vector<char> &row_mask ) const {
+
+  if( root_ ) {
+    evaluate( root_ , row_mask );
+    // only the rows that are definitely in
+    for( int i = 0 , is = row_mask.size() ; i < is ; ++i ) {
+      row_mask[i] = ROW_TRUE == row_mask[i];
+    }
+  } else {
+    row_mask.assign( table_.num_file_rows() , 1 );
+  }
+
+}
+
+// *****************************************************************************************
+bool SmivDataFilter::tokenise( const QString &expr ) {
+
+  static const QString specials( "()<>=!&|'\"" );
+
+  tokens_.clear();
+  for( int i = 0 , is = expr.length() ; i < is ; ) {
+    QChar c = expr[i];
+    if( c.isSpace() ) {
+      ++i;
+      continue;
+    }
+
+    Token tok;
+    tok.col_num_ = -1;
+    tok.num_ = 0.0;
+    tok.op_ = EQ_OP;
+    QChar next_c = i + 1 < is ? expr[i + 1] : QChar();
+    int tok_len = 1;
+    if( '(' == c ) {
+      tok.type_ = LBRACKET_TOK;
+    } else if( ')' == c ) {
+      tok.type_ = RBRACKET_TOK;
+    } else if( '&' == c && '&' == next_c ) {
+      tok.type_ = AND_TOK;
+      tok_len = 2;
+    } else if( '|' == c && '|' == next_c ) {
+      tok.type_ = OR_TOK;
+      tok_len = 2;
+    } else if( '<' == c || '>' == c || '=' == c || '!' == c ) {
+      tok.type_ = COMPARE_TOK;
+      if( '=' == next_c ) {
+        tok_len = 2;
+        tok.op_ = '<' == c ? LE_OP : ( '>' == c ? GE_OP : ( '=' == c ? EQ_OP : NE_OP ) );
+      } else if( '<' == c && '>' == next_c ) {
+        tok_len = 2;
+        tok.op_ = NE_OP;
+      } else if( '!' == c ) {
+        tok.type_ = NOT_TOK;
+      } else {
+        tok.op_ = '<' == c ? LT_OP : ( '>' == c ? GT_OP : EQ_OP );
+      }
+    } else if( '\'' == c || '"' == c ) {
+      int close = expr.indexOf( c , i + 1 );
+      if( -1 == close ) {
+        error_ = QString( "There's no closing %1 for the one at position %2." ).arg( c ).arg( i + 1 );
+        return false;
+      }
+      tok_len = close - i + 1;
+      tok.text_ = expr.mid( i + 1 , close - i - 1 );
+      if( '\'' == c ) {
+        tok.type_ = STRING_TOK;
+      } else {
+        tok.type_ = COLUMN_TOK;
+        tok.col_num_ = table_.column_number( tok.text_ );
+        if( -1 == tok.col_num_ ) {
+          error_ = QString( "There's no column called %1." ).arg( tok.text_ );
+          return false;
+        }
+      }
+    } else {
+      int j = i;
+      while( j < is && !expr[j].isSpace() && -1 == specials.indexOf( expr[j] ) ) {
+        ++j;
+      }
+      if( j == i ) {
+        error_ = QString( "Didn't expect %1 at position %2." ).arg( c ).arg( i + 1 );
+        return false;
+      }
+      tok_len = j - i;
+      QString word = expr.mid( i , tok_len );
+      QString lc_word = word.toLower();
+      bool is_num = false;
+      tok.num_ = word.toDouble( &is_num );
+      if( is_num ) {
+        tok.type_ = NUMBER_TOK;
+        tok.text_ = word;
+      } else if( "and" == lc_word ) {
+        tok.type_ = AND_TOK;
+      } else if( "or" == lc_word ) {
+        tok.type_ = OR_TOK;
+      } else if( "not" == lc_word ) {
+        tok.type_ = NOT_TOK;
+      } else {
+        tok.type_ = COLUMN_TOK;
+        tok.text_ = word;
+        tok.col_num_ = table_.column_number( word );
+        if( -1 == tok.col_num_ ) {
+          error_ = QString( "There's no column called %1. Strings need 'single quotes'." ).arg( word );
+          return false;
+        }
+      }
+    }
+
+    if( tok.text_.isEmpty() ) {
+      tok.text_ = expr.mid( i , tok_len );
+    }
+    tokens_.push_back( tok );
+    i += tok_len;
+  }
+
+  Token end_tok;
+  end_tok.type_ = END_TOK;
+  end_tok.text_ = "the end";
+  tokens_.push_back( end_tok );
+
+  return true;
+
+}
+
+// *****************************************************************************************
+SmivDataFilter::pNode SmivDataFilter::parse_or() {
+
+  pNode lhs = parse_and();
+  while( lhs && OR_TOK == tokens_[next_tok_].type_ ) {
+    ++next_tok_;
+    pNode rhs = parse_and();
+    if( !rhs ) {
+      return pNode();
+    }
+    pNode node( new Node );
+    node->type_ = OR_TOK;
+    node->lhs_ = lhs;
+    node->rhs_ = rhs;
+    lhs = node;
+  }
+
+  return lhs;
+
+}
+
+// *****************************************************************************************
+SmivDataFilter::pNode SmivDataFilter::parse_and() {
+
+  pNode lhs = parse_not();
+  while( lhs && AND_TOK == tokens_[next_tok_].type_ ) {
+    ++next_tok_;
+    pNode rhs = parse_not();
+    if( !rhs ) {
+      return pNode();
+    }
+    pNode node( new Node );
+    node->type_ = AND_TOK;
+    node->lhs_ = lhs;
+    node->rhs_ = rhs;
+    lhs = node;
+  }
+
+  return lhs;
+
+}
+
+// *****************************************************************************************
+SmivDataFilter::pNode SmivDataFilter::parse_not() {
+
+  if( NOT_TOK == tokens_[next_tok_].type_ ) {
+    ++next_tok_;
+    pNode arg = parse_not();
+    if( !arg ) {
+      return pNode();
+    }
+    pNode node( new Node );
+    node->type_ = NOT_TOK;
+    node->lhs_ = arg;
+    return node;
+  }
+
+  if( LBRACKET_TOK == tokens_[next_tok_].type_ ) {
+    ++next_tok_;
+    pNode node = parse_or();
+    if( !node ) {
+      return pNode();
+    }
+    if( RBRACKET_TOK != tokens_[next_tok_].type_ ) {
+      error_ = QString( "Expected ) but found %1." ).arg( tokens_[next_tok_].text_ );
+      return pNode();
+    }
+    ++next_tok_;
+    return node;
+  }
+
+  return parse_comparison();
+
+}
+
+// *****************************************************************************************
+SmivDataFilter::pNode SmivDataFilter::parse_comparison() {
+
+  pNode node( new Node );
+  node->type_ = COMPARE_TOK;
+  if( !parse_operand( node->lhs_opd_ ) ) {
+    return pNode();
+  }
+  if( COMPARE_TOK != tokens_[next_tok_].type_ ) {
+    error_ = QString( "Expected a comparison such as < or == but found %1." ).arg( tokens_[next_tok_].text_ );
+    return pNode();
+  }
+  node->op_ = tokens_[next_tok_].op_;
+  ++next_tok_;
+  if( !parse_operand( node->rhs_opd_ ) ) {
+    return pNode();
+  }
+
+  return node;
+
+}
+
+// *****************************************************************************************
+bool SmivDataFilter::parse_operand( Operand &opd ) {
+
+  const Token &tok = tokens_[next_tok_];
+  if( COLUMN_TOK != tok.type_ && NUMBER_TOK != tok.type_ && STRING_TOK != tok.type_ ) {
+    error_ = QString( "Expected a column, number or string but found %1." ).arg( tok.text_ );
+    return false;
+  }
+
+  opd.col_num_ = tok.col_num_;
+  opd.is_num_ = NUMBER_TOK == tok.type_;
+  opd.num_ = tok.num_;
+  opd.text_ = tok.text_;
+  ++next_tok_;
+
+  return true;
+
+}
+
+// *****************************************************************************************
+// row_mask has ROW_TRUE, ROW_FALSE or ROW_NULL for each row, the last where
+// the answer depends on a null, combined as SQL does, so that ! doesn't let
+// rows with nulls in.
+void SmivDataFilter::evaluate( const pNode &node , vector<char> &row_mask ) const {
+
+  if( COMPARE_TOK == node->type_ ) {
+    compare( *node , row_mask );
+    return;
+  }
+
+  evaluate( node->lhs_ , row_mask );
+  if( NOT_TOK == node->type_ ) {
+    for( int i = 0 , is = row_mask.size() ; i < is ; ++i ) {
+      if( ROW_NULL != row_mask[i] ) {
+        row_mask[i] = ROW_TRUE == row_mask[i] ? ROW_FALSE : ROW_TRUE;
+      }
+    }
+    return;
+  }
+
+  vector<char> rhs_mask;
+  evaluate( node->rhs_ , rhs_mask );
+  if( AND_TOK == node->type_ ) {
+    for( int i = 0 , is = row_mask.size() ; i < is ; ++i ) {
+      if( ROW_FALSE == row_mask[i] || ROW_FALSE == rhs_mask[i] ) {
+        row_mask[i] = ROW_FALSE;
+      } else if( ROW_NULL == row_mask[i] || ROW_NULL == rhs_mask[i] ) {
+        row_mask[i] = ROW_NULL;
+      }
+    }
+  } else {
+    for( int i = 0 , is = row_mask.size() ; i < is ; ++i ) {
+      if( ROW_TRUE == row_mask[i] || ROW_TRUE == rhs_mask[i] ) {
+        row_mask[i] = ROW_TRUE;
+      } else if( ROW_NULL == row_mask[i] || ROW_NULL == rhs_mask[i] ) {
+        row_mask[i] = ROW_NULL;
+      }
+    }
+  }
+
+}
+
+// *****************************************************************************************
+// The values of col as numbers, for comparing with numbers. A string column's
+// values that don't read as numbers are nulls, as are real nulls.
+void SmivDataFilter::numeric_values( const SmivDataColumn &col ,
+                                     vector<double> &vals , vector<char> &nulls ) {
+
+  int num_rows = col.size();
+  vals.resize( num_rows );
+  nulls.resize( num_rows );
+  if( SmivDataColumn::STRING_COL != col.type() ) {
+    for( int i = 0 ; i < num_rows ; ++i ) {
+      nulls[i] = col.is_null( i );
+      vals[i] = nulls[i] ? 0.0 : col.double_value( i );
+    }
+    return;
+  }
+
+  // each distinct string only needs reading once
+  const vector<QString> &dict = col.dictionary();
+  vector<double> dict_vals( dict.size() , 0.0 );
+  vector<char> dict_ok( dict.size() , 0 );
+  for( int i = 0 , is = dict.size() ; i < is ; ++i ) {
+    bool ok = false;
+    dict_vals[i] = dict[i].trimmed().toDouble( &ok );
+    dict_ok[i] = ok;
+  }
+  for( int i = 0 ; i < num_rows ; ++i ) {
+    nulls[i] = col.is_null( i ) || !dict_ok[col.code( i )];
+    vals[i] = dict_vals[col.code( i )];
+  }
+
+}
+
+// *****************************************************************************************
+// Numbers are compared as numbers, anything else as strings. If a number is
+// compared with a column of strings, or a column of numbers with one of
+// strings, the strings are read as numbers.
+void SmivDataFilter::compare( const Node &node , vector<char> &row_mask ) const {
+
+  int num_rows = table_.num_file_rows();
+  row_mask.assign( num_rows , ROW_NULL );
+
+  // a column, if there is one, goes on the left
+  Operand lhs = node.lhs_opd_ , rhs = node.rhs_opd_;
+  CompareOp op = node.op_;
+  if( -1 == lhs.col_num_ && -1 != rhs.col_num_ ) {
+    swap( lhs , rhs );
+    switch( op ) {
+    case LT_OP : op = GT_OP; break;
+    case LE_OP : op = GE_OP; break;
+    case GT_OP : op = LT_OP; break;
+    case GE_OP : op = LE_OP; break;
+    default : break;
+    }
+  }
+
+  if( -1 == lhs.col_num_ ) {
+    bool res = lhs.is_num_ && rhs.is_num_ ? test( lhs.num_ , op , rhs.num_ ) :
+                                            test( lhs.text_ , op , rhs.text_ );
+    row_mask.assign( num_rows , res ? ROW_TRUE : ROW_FALSE );
+    return;
+  }
+
+  const SmivDataColumn &lcol = table_.column( lhs.col_num_ );
+  bool lhs_num = SmivDataColumn::STRING_COL != lcol.type();
+  vector<double> lvals , rvals;
+  vector<char> lnulls , rnulls;
+
+  if( -1 == rhs.col_num_ ) {
+    if( rhs.is_num_ ) {
+      numeric_values( lcol , lvals , lnulls );
+      for( int i = 0 ; i < num_rows ; ++i ) {
+        if( !lnulls[i] ) {
+          row_mask[i] = test( lvals[i] , op , rhs.num_ ) ? ROW_TRUE : ROW_FALSE;
+        }
+      }
+    } else if( !lhs_num ) {
+      // each distinct string only needs comparing once
+      const vector<QString> &dict = lcol.dictionary();
+      vector<char> code_passes( dict.size() );
+      for( int i = 0 , is = dict.size() ; i < is ; ++i ) {
+        code_passes[i] = test( dict[i] , op , rhs.text_ ) ? ROW_TRUE : ROW_FALSE;
+      }
+      for( int i = 0 ; i < num_rows ; ++i ) {
+        if( !lcol.is_null( i ) ) {
+          row_mask[i] = code_passes[lcol.code( i )];
+        }
+      }
+    } else {
+      for( int i = 0 ; i < num_rows ; ++i ) {
+        if( !lcol.is_null( i ) ) {
+          row_mask[i] = test( lcol.text( i ) , op , rhs.text_ ) ? ROW_TRUE : ROW_FALSE;
+        }
+      }
+    }
+    return;
+  }
+
+  const SmivDataColumn &rcol = table_.column( rhs.col_num_ );
+  bool rhs_num = SmivDataColumn::STRING_COL != rcol.type();
+  if( lhs_num || rhs_num ) {
+    numeric_values( lcol , lvals , lnulls );
+    numeric_values( rcol , rvals , rnulls );
+    for( int i = 0 ; i < num_rows ; ++i ) {
+      if( !lnulls[i] && !rnulls[i] ) {
+        row_mask[i] = test( lvals[i] , op , rvals[i] ) ? ROW_TRUE : ROW_FALSE;
+      }
+    }
+  } else {
+    for( int i = 0 ; i < num_rows ; ++i ) {
+      if( !lcol.is_null( i ) && !rcol.is_null( i ) ) {
+        row_mask[i] = test( lcol.text( i ) , op , rcol.text( i ) ) ? ROW_TRUE : ROW_FALSE;
+      }
+    }
+  }
+
+}
@@ -7,32 +7,288 @@
 
 #include "SmivDataTable.H"
 
+#include "QTParallelFor.H"
+
+#include <QByteArray>
+#include <QFile>
 #include <QFileInfo>
 #include <QMessageBox>
+#include <QMetaObject>
+#include <QMutexLocker>
+#include <QProgressDialog>
+#include <QRunnable>
 #include <QString>
 
-#include <fstream>
-#include <iostream>
+#include <algorithm>
+#include <deque>
 #include <limits>
+#include <string>
 
-#include <boost/algorithm/string.hpp>
-#include <boost/bind.hpp>
-#include <boost/foreach.hpp>
+#include <cstring>
 
-using namespace boost;
 using namespace std;
 
+typedef SmivDataColumn::Field Field;
+
+static const int MAX_BAD_LINES_REPORTED = 20;
+// files bigger than this are only split into columns when they need to be
+static const qint64 LAZY_FILE_SIZE = 64 * 1024 * 1024;
+// rows handed to the view at a time by fetchMore
+static const int FETCH_BLOCK_SIZE = 10000;
+// records split into fields by each item of a SmivDataParser
+static const int PARSE_BLOCK_SIZE = 4096;
+// roughly how many fields fetch_all holds at once, while it's making columns
+// from them
+static const int MAX_FIELDS_HELD = 4 * 1024 * 1024;
+
+namespace {
+
+// *****************************************************************************************
+// The field starting at p, which runs to the next delim or newline that isn't
+// inside quotes, or to end, which is returned. Quotes only count at the start
+// of a field, and "" inside them is an escaped quote. val_start and val_end
+// are the value, inside the quotes if there are any, and escaped says if
+// there's a "" in it. Anything between a closing quote and the delimiter is
+// dropped. With no closing quote, the value is the rest of the buffer.
+// find_record_end and split_record both use it, so they always agree on
+// where the quoted bits are.
+const char *scan_field( const char *p , const char *end , char delim ,
+                        const char *&val_start , const char *&val_end ,
+                        bool &escaped ) {
+
+  escaped = false;
+  if( p < end && '"' == *p ) {
+    val_start = p + 1;
+    val_end = end;
+    const char *q = val_start;
+    while( q < end ) {
+      const char *quote = static_cast<const char *>( memchr( q , '"' , end - q ) );
+      if( !quote ) {
+        break;
+      }
+      if( quote + 1 < end && '"' == quote[1] ) {
+        escaped = true;
+        q = quote + 2;
+      } else {
+        val_end = quote;
+        break;
+      }
+    }
+    p = val_end < end ? val_end + 1 : end;
+    while( p < end && delim != *p && '\n' != *p ) {
+      ++p;
+    }
+    return p;
+  }
+
+  val_start = p;
+  while( p < end && delim != *p && '\n' != *p ) {
+    ++p;
+  }
+  val_end = p;
+  return p;
+
+}
+
+// *****************************************************************************************
+// The end of the record starting at rec_start, which is the next newline that
+// isn't inside a quoted field, or buf_end.
+const char *find_record_end( const char *rec_start , const char *buf_end , char delim ) {
+
+  const char *p = rec_start , *val_start , *val_end;
+  bool escaped;
+  while( 1 ) {
+    p = scan_field( p , buf_end , delim , val_start , val_end , escaped );
+    if( p == buf_end || '\n' == *p ) {
+      return p;
+    }
+    ++p; // past the delimiter
+  }
+
+}
+
+// *****************************************************************************************
+// Split the record into fields. Quoted fields lose their quotes, and if they
+// have escaped quotes in them they're unescaped into a new string in
+// unescaped, which must outlast the fields, otherwise the fields point into
+// the record.
+void split_record( const char *rec_start , const char *rec_end , char delim ,
+                   deque<string> &unescaped , vector<Field> &fields ) {
+
+  fields.clear();
+  const char *p = rec_start , *val_start , *val_end;
+  bool escaped;
+  while( 1 ) {
+    p = scan_field( p , rec_end , delim , val_start , val_end , escaped );
+    if( escaped ) {
+      string val;
+      val.reserve( val_end - val_start );
+      for( const char *c = val_start ; c < val_end ; ++c ) {
+        val += *c;
+        if( '"' == *c ) {
+          ++c;
+        }
+      }
+      unescaped.push_back( val );
+      fields.push_back( Field( unescaped.back().data() , unescaped.back().length() ) );
+    } else {
+      fields.push_back( Field( val_start , val_end - val_start ) );
+    }
+    if( p == rec_end ) {
+      break;
+    }
+    ++p; // past the delimiter
+  }
+
+}
+
+} // EO anonymous namespace
+
+// *****************************************************************************************
+// The function object for DACLIB::parallel_for that splits records into
+// fields. It's given the records a batch at a time, and each item is a block
+// of PARSE_BLOCK_SIZE of them. Each record's fields go into its own slot in
+// col_fields, so nothing needs locking.
+class SmivDataParser {
+
+public :
+
+  SmivDataParser( char delim , vector<vector<Field> > &col_fields ) :
+    records_( 0 ) , delim_( delim ) , col_fields_( col_fields ) ,
+    unescaped_( DACLIB::num_parallel_workers() ) ,
+    fields_( DACLIB::num_parallel_workers() ) {}
+
+  // The next batch to split, whose fields replace the last batch's in
+  // col_fields. records must last until the next call.
+  void set_records( const vector<pair<const char * , const char *> > &records ) {
+    records_ = &records;
+    num_fields_.assign( records.size() , 0 );
+    for( int i = 0 , is = col_fields_.size() ; i < is ; ++i ) {
+      col_fields_[i].resize( records.size() );
+    }
+    for( int i = 0 , is = unescaped_.size() ; i < is ; ++i ) {
+      unescaped_[i].clear();
+    }
+  }
+
+  int num_blocks() const {
+    return ( int( records_->size() ) + PARSE_BLOCK_SIZE - 1 ) / PARSE_BLOCK_SIZE;
+  }
+  // the number of fields each record in the batch had, which is only right
+  // for those that were put in col_fields.
+  const vector<int> &num_fields() const { return num_fields_; }
+
+  void operator()( int block_num , int worker_num ) {
+    vector<Field> &fields = fields_[worker_num];
+    int num_cols = col_fields_.size();
+    for( int i = block_num * PARSE_BLOCK_SIZE ,
+         is = min( int( records_->size() ) , i + PARSE_BLOCK_SIZE ) ; i < is ; ++i ) {
+      split_record( (*records_)[i].first , (*records_)[i].second , delim_ ,
+                    unescaped_[worker_num] , fields );
+      num_fields_[i] = fields.size();
+      if( num_cols == int( fields.size() ) ) {
+        for( int j = 0 ; j < num_cols ; ++j ) {
+          col_fields_[j][i] = fields[j];
+        }
+      }
+    }
+  }
+
+private :
+
+  const vector<pair<const char * , const char *> > *records_;
+  char delim_;
+  vector<vector<Field> > &col_fields_;
+  vector<int> num_fields_;
+  // the unescaped fields, by worker, that the Fields point into
+  vector<deque<string> > unescaped_;
+  vector<vector<Field> > fields_; // by worker, so they're re-used
+
+};
+
+// *****************************************************************************************
+// And the one that adds each batch of fields to the columns, one column per
+// item.
+class SmivColumnBuilder {
+
+public :
+
+  SmivColumnBuilder( const vector<vector<Field> > &col_fields ,
+                     vector<SmivDataColumn> &columns ) :
+    col_fields_( col_fields ) , columns_( columns ) {}
+
+  void operator()( int col_num , int worker_num ) {
+    Q_UNUSED( worker_num );
+    // the names are strings whatever they look like
+    columns_[col_num].append_values( col_fields_[col_num] , col_num > 0 );
+  }
+
+private :
+
+  const vector<vector<Field> > &col_fields_;
+  vector<SmivDataColumn> &columns_;
+
+};
+
+// *****************************************************************************************
+// Hashes the names of a lazy SmivDataTable, straight from the file, in a
+// thread of its own. It gives up if the table's rows change, which they
+// can't do until it has, as the table waits for it before letting go of the
+// file.
+class SmivNameRowsJob : public QRunnable {
+
+public :
+
+  SmivNameRowsJob( SmivDataTable *table , int num_rows , int generation ) :
+    table_( table ) , num_rows_( num_rows ) , generation_( generation ) {}
+
+  void run() {
+    boost::shared_ptr<QHash<QString,int> > name_rows( new QHash<QString,int> );
+    name_rows->reserve( num_rows_ );
+    for( int i = num_rows_ - 1 ; i >= 0 ; --i ) {
+      if( !( i % CHECK_EVERY ) && generation_ != table_->name_rows_gen_.loadAcquire() ) {
+        return;
+      }
+      // backwards, so that the first of any duplicates is the one kept
+      name_rows->insert( table_->record_name( i ) , i );
+    }
+    table_->name_rows_built( name_rows , generation_ );
+  }
+
+private :
+
+  static const int CHECK_EVERY = 4096;
+
+  SmivDataTable *table_;
+  int num_rows_;
+  int generation_;
+
+};
+
 // *****************************************************************************************
 SmivDataTable::SmivDataTable( QObject *parent ) :
-    QAbstractTableModel( parent ) ,
-    last_sort_order_( Qt::AscendingOrder ) {
+    QAbstractTableModel( parent ) , num_rows_( 0 ) ,
+    last_sort_order_( Qt::AscendingOrder ) , name_rows_valid_( false ) ,
+    name_rows_gen_( 0 ) , name_rows_job_gen_( -1 ) , built_name_rows_gen_( -1 ) ,
+    lazy_( false ) , parent_widget_( 0 ) , data_buf_( 0 ) , data_buf_end_( 0 ) ,
+    delim_( ',' ) , num_fetched_( 0 ) , row_cache_( 1000 ) {
+
+  name_rows_pool_.setMaxThreadCount( 1 );
+
+}
+
+// *****************************************************************************************
+// out of line so the QFile is complete for the scoped_ptr
+SmivDataTable::~SmivDataTable() {
+
+  cancel_name_rows_job();
 
 }
 
 // *****************************************************************************************
 int SmivDataTable::rowCount( const QModelIndex &parent ) const {
 
-  return data_.size();
+  return lazy_ ? num_fetched_ : int( sort_order_.size() );
 
 }
 
@@ -46,33 +302,44 @@ int SmivDataTable::columnCount( const QModelIndex &parent ) const {
 // *****************************************************************************************
 QVariant SmivDataTable::data( const QModelIndex &index , int role ) const {
 
-  if( !index.isValid() || role != Qt::DisplayRole ) {
+  if( !index.isValid() || ( role != Qt::DisplayRole && role != TypedValueRole ) ) {
      return QVariant();
    }
 
-  // convert the index number into the right index if the table is sorted,
-  // otherwise returns index.row().
-  int row_num = get_sorted_row_number( index.row() );
-
-  if( index.column() < columnCount() && row_num < rowCount() ) {
-    return *data_[row_num][index.column()];
-  } else {
+  // the numbers are shown as they were in the file, not as QVariant would
+  // write them.
+  if( Qt::DisplayRole == role && !lazy_ ) {
+    int sort_row_num = get_sorted_row_number( index.row() );
+    if( index.column() < columnCount() && sort_row_num < num_rows_ ) {
+      return columns_[index.column()].text( sort_row_num );
+    }
     return QVariant();
   }
 
-  return QVariant();
+  return data( index.row() , index.column() );
 
 }
 
 // *****************************************************************************************
 QVariant SmivDataTable::data( int row_num , int col_num ) const {
 
+  if( lazy_ ) {
+    if( row_num < 0 || row_num >= num_fetched_ || col_num < 0 ) {
+      return QVariant();
+    }
+    const QStringList *fields = record_fields( row_num );
+    if( col_num < fields->size() && !fields->at( col_num ).isEmpty() ) {
+      return fields->at( col_num );
+    }
+    return QVariant();
+  }
+
   // convert the index number into the right index if the table is sorted,
   // otherwise returns index.row().
   int sort_row_num = get_sorted_row_number( row_num );
 
-  if( col_num < columnCount() && sort_row_num < rowCount() ) {
-    return *data_[sort_row_num][col_num];
+  if( col_num < columnCount() && sort_row_num < num_rows_ ) {
+    return columns_[col_num].value( sort_row_num );
   } else {
     return QVariant();
   }
@@ -104,160 +371,524 @@ QVariant SmivDataTable::headerData( int section , Qt::Orientation orientation ,
 // *****************************************************************************************
 void SmivDataTable::sort( int column , Qt::SortOrder order ) {
 
-  if( column >= columnCount() || column < 0 ) {
+  sort( vector<pair<int,Qt::SortOrder> >( 1 , make_pair( column , order ) ) );
+
+}
+
+// *****************************************************************************************
+void SmivDataTable::sort( const vector<pair<int,Qt::SortOrder> > &sort_keys ) {
+
+  if( !fetch_all() ) {
     return;
   }
-
-  // see if it's numbers or strings
-  bool is_num( true );
-  for( int i = 0 , is = rowCount() ; i < is ; ++i ) {
-    // Originally I did data_[i][column]->canConvert( Qt::Double ) but this always gave
-    // true for a string, with a double value of 0.0. Made the whole canConvert business
-    // seem a bit pointless, somehow!
-    data_[i][column]->toString().toDouble( & is_num );
-    if( !is_num ) {
-      break;
+  for( int i = 0 , is = sort_keys.size() ; i < is ; ++i ) {
+    if( sort_keys[i].first >= columnCount() || sort_keys[i].first < 0 ) {
+      return;
     }
   }
+  if( sort_keys.empty() ) {
+    return;
+  }
 
-  if( is_num ) {
-    sort_by_number( column , order );
-  } else {
-    sort_by_string( column , order );
+  emit layoutAboutToBeChanged(); // tell the view
+
+  sort_keys_ = sort_keys;
+  last_sort_order_ = sort_keys.front().second;
+  make_sort_order();
+
+  emit layoutChanged();
+
+}
+
+// *****************************************************************************************
+void SmivDataTable::set_row_filter( const vector<char> &row_mask ) {
+
+  if( !fetch_all() ) {
+    return;
   }
+  beginResetModel();
+  row_mask_ = row_mask;
+  make_sort_order();
+  endResetModel();
+
+}
+
+// *****************************************************************************************
+void SmivDataTable::clear_row_filter() {
+
+  set_row_filter( vector<char>() );
+
+}
+
+// *****************************************************************************************
+int SmivDataTable::column_number( const QString &col_name ) const {
+
+  vector<QString>::const_iterator p = find( col_names_.begin() , col_names_.end() , col_name );
+  return p == col_names_.end() ? -1 : int( p - col_names_.begin() );
 
-  last_sort_order_ = order;
+}
+
+// *****************************************************************************************
+bool SmivDataTable::canFetchMore( const QModelIndex &parent ) const {
 
-  emit layoutChanged(); // tell the view
+  return !parent.isValid() && lazy_ && num_fetched_ < int( rec_starts_.size() );
 
 }
 
 // *****************************************************************************************
+void SmivDataTable::fetchMore( const QModelIndex &parent ) {
+
+  if( canFetchMore( parent ) ) {
+    fetch_to( min( int( rec_starts_.size() ) , num_fetched_ + FETCH_BLOCK_SIZE ) - 1 );
+  }
+
+}
+
+// *****************************************************************************************
+void SmivDataTable::fetch_to( int row_num ) {
+
+  if( !lazy_ || row_num < num_fetched_ ) {
+    return;
+  }
+  row_num = min( row_num , int( rec_starts_.size() ) - 1 );
+  beginInsertRows( QModelIndex() , num_fetched_ , row_num );
+  num_fetched_ = row_num + 1;
+  endInsertRows();
+
+}
+
+// *****************************************************************************************
+// The file's read into a buffer that's normally just the file mapped into
+// memory. A quick pass finds where the lines start, allowing for newlines in
+// quoted fields, and for small files that's followed straight away by
+// fetch_all(). Big ones are left until they need to be.
 void SmivDataTable::read_data_from_file( QWidget *parent_widget , const QString &filename ) {
 
-  ifstream ifs( filename.toLocal8Bit().data() );
-  if( !ifs || !ifs.good() ) {
+  boost::scoped_ptr<QFile> file( new QFile( filename ) );
+  if( !file->open( QIODevice::ReadOnly ) ) {
     QMessageBox::warning( parent_widget , "Data file error" ,
                           QString( "Couldn't open %1 for reading.").arg( filename ) );
     return;
   }
 
-  string first_line;
-  getline( ifs , first_line );
-  vector<string> split_line;
-  split( split_line , first_line , is_any_of( " ,\t") );
-  beginInsertColumns( QModelIndex() , columnCount() , columnCount() + split_line.size() );
-  BOOST_FOREACH( string &header , split_line ) {
-    col_names_.push_back( header.c_str() );
+  // not all files can be mapped, so there's a fallback
+  QByteArray contents;
+  const char *buf = reinterpret_cast<const char *>( file->size() ? file->map( 0 , file->size() ) : 0 );
+  qint64 buf_len = file->size();
+  if( !buf ) {
+    contents = file->readAll();
+    buf = contents.constData();
+    buf_len = contents.length();
+  }
+  const char *buf_end = buf + buf_len;
+
+  // It's tab-separated if there's a tab in the first line, comma-separated
+  // otherwise.
+  const char *first_nl = static_cast<const char *>( memchr( buf , '\n' , buf_len ) );
+  char delim = memchr( buf , '\t' , ( first_nl ? first_nl : buf_end ) - buf ) ? '\t' : ',';
+  const char *header_end = find_record_end( buf , buf_end , delim );
+  const char *p = header_end < buf_end ? header_end + 1 : buf_end;
+  int line_num = 1 + count( buf , p , '\n' );
+  if( header_end > buf && '\r' == header_end[-1] ) {
+    --header_end;
+  }
+  if( header_end == buf ) {
+    return;
+  }
+  deque<string> header_unescaped;
+  vector<SmivDataColumn::Field> header_fields;
+  split_record( buf , header_end , delim , header_unescaped , header_fields );
+  vector<QString> new_col_names;
+  for( int i = 0 , is = header_fields.size() ; i < is ; ++i ) {
+    new_col_names.push_back( QString::fromLocal8Bit( header_fields[i].first , header_fields[i].second ) );
   }
-  endInsertColumns();
 
-  string next_line;
-  int line_count = 0;
-  while( 1 ) {
-    getline( ifs , next_line );
-    if( ifs.eof() || !ifs.good() ) {
-      break;
+  // blank lines are quietly ignored. Records can have newlines in quoted
+  // fields, so the line each starts on is kept for error messages.
+  vector<qint64> rec_starts;
+  vector<int> rec_lines;
+  while( p < buf_end ) {
+    const char *rec_end = find_record_end( p , buf_end , delim );
+    const char *next_p = rec_end < buf_end ? rec_end + 1 : buf_end;
+    if( rec_end > p && '\r' == rec_end[-1] ) {
+      --rec_end;
     }
-    ++line_count;
-    beginInsertRows( QModelIndex() , rowCount() , rowCount() );
-    data_.push_back( vector<pQVar>() );
-    split_line.clear();
-    split( split_line , next_line , is_any_of( "," ) );
-    // initialise CoreContainedIn column
-    if( int( split_line.size() ) != columnCount() ) {
-      QMessageBox msg( parent_widget );
-      msg.setText( QString( "Line %1 has different number of columns from rest ").arg( line_count ) );
-      msg.setInformativeText( QString( "First line had %1 columns, this has %2." ).arg( columnCount() ).arg( split_line.size() ) );
-      msg.setStandardButtons( QMessageBox::Ignore | QMessageBox::Abort );
-      msg.setDefaultButton( QMessageBox::Abort );
-      int ret_val = msg.exec();
-      if( QMessageBox::Abort == ret_val ) {
-        break;
-      } else if( QMessageBox::Ignore == ret_val ) {
-        continue;
+    if( rec_end > p ) {
+      rec_starts.push_back( p - buf );
+      rec_lines.push_back( line_num );
+    }
+    line_num += count( p , next_p , '\n' );
+    p = next_p;
+  }
+
+  beginResetModel();
+
+  clear_data();
+  col_names_ = new_col_names;
+  data_file_.swap( file );
+  data_contents_ = contents;
+  if( !data_contents_.isEmpty() ) {
+    buf = data_contents_.constData();
+  }
+  data_buf_ = buf;
+  data_buf_end_ = buf + buf_len;
+  data_filename_ = QFileInfo( filename ).fileName();
+  parent_widget_ = parent_widget;
+  delim_ = delim;
+  rec_starts_.swap( rec_starts );
+  rec_lines_.swap( rec_lines );
+  num_rows_ = rec_starts_.size();
+  lazy_ = true;
+
+  endResetModel();
+
+  if( buf_len < LAZY_FILE_SIZE && !fetch_all() ) {
+    beginResetModel();
+    clear_data();
+    col_names_.clear();
+    endResetModel();
+  }
+
+}
+
+// *****************************************************************************************
+// The records are done in batches, each split into fields in parallel and
+// then added to the columns in parallel, so only a batch's worth of fields
+// is held at once, however big the file is. Records with the wrong number of
+// fields are left out as it goes, and only if the user says so at the end
+// are the columns kept.
+bool SmivDataTable::fetch_all() {
+
+  if( !lazy_ ) {
+    return true;
+  }
+
+  int num_cols = col_names_.size();
+  int num_recs = rec_starts_.size();
+  // a whole number of parse blocks, so the progress counts them all the way
+  // through
+  int batch_size = PARSE_BLOCK_SIZE * max( 1 , MAX_FIELDS_HELD / ( PARSE_BLOCK_SIZE * max( 1 , num_cols ) ) );
+
+  vector<SmivDataColumn> new_columns( num_cols );
+  vector<vector<Field> > col_fields( num_cols );
+  vector<pair<const char * , const char *> > records;
+  SmivDataParser parser( delim_ , col_fields );
+  SmivColumnBuilder builder( col_fields , new_columns );
+  // the record number and number of fields of each bad record
+  vector<pair<int,int> > bad_recs;
+
+  QProgressDialog progress( QString( "Reading %1." ).arg( data_filename_ ) , "Cancel" , 0 ,
+                            ( num_recs + PARSE_BLOCK_SIZE - 1 ) / PARSE_BLOCK_SIZE ,
+                            parent_widget_ );
+  progress.setWindowModality( Qt::WindowModal );
+  progress.setMinimumDuration( 500 );
+
+  for( int batch_start = 0 ; batch_start < num_recs ; batch_start += batch_size ) {
+    records.resize( min( batch_size , num_recs - batch_start ) );
+    for( int i = 0 , is = records.size() ; i < is ; ++i ) {
+      record_bounds( batch_start + i , records[i].first , records[i].second );
+    }
+    parser.set_records( records );
+    if( !DACLIB::parallel_for( parser , parser.num_blocks() , &progress ,
+                               batch_start / PARSE_BLOCK_SIZE ) ) {
+      return false;
+    }
+
+    const vector<int> &num_fields = parser.num_fields();
+    vector<int> good_recs;
+    for( int i = 0 , is = num_fields.size() ; i < is ; ++i ) {
+      if( num_fields[i] == num_cols ) {
+        good_recs.push_back( i );
+      } else {
+        bad_recs.push_back( make_pair( batch_start + i , num_fields[i] ) );
       }
     }
-    BOOST_FOREACH( string &next_data , split_line ) {
-      data_.back().push_back( pQVar( new QVariant( next_data.c_str() ) ) );
+    if( int( good_recs.size() ) < int( num_fields.size() ) ) {
+      for( int i = 0 ; i < num_cols ; ++i ) {
+        vector<Field> &fields = col_fields[i];
+        for( int j = 0 , js = good_recs.size() ; j < js ; ++j ) {
+          fields[j] = fields[good_recs[j]];
+        }
+        fields.resize( good_recs.size() );
+      }
     }
-    endInsertRows();
+    DACLIB::parallel_for( builder , num_cols );
+  }
+  vector<vector<Field> >().swap( col_fields );
 
+  // all the lines with the wrong number of columns are reported together
+  if( !bad_recs.empty() ) {
+    QString details;
+    for( int i = 0 , is = min( int( bad_recs.size() ) , MAX_BAD_LINES_REPORTED ) ; i < is ; ++i ) {
+      details += QString( "Line %1 has %2 columns.\n" ).arg( rec_lines_[bad_recs[i].first] ).arg( bad_recs[i].second );
+    }
+    if( int( bad_recs.size() ) > MAX_BAD_LINES_REPORTED ) {
+      details += QString( "and %1 more.\n" ).arg( bad_recs.size() - MAX_BAD_LINES_REPORTED );
+    }
+    QMessageBox msg( parent_widget_ );
+    msg.setText( QString( "%1 lines have a different number of columns from the first line, which has %2." )
+                 .arg( bad_recs.size() ).arg( num_cols ) );
+    msg.setInformativeText( "They can be left out, or the file not read at all." );
+    msg.setDetailedText( details );
+    msg.setStandardButtons( QMessageBox::Ignore | QMessageBox::Abort );
+    msg.setDefaultButton( QMessageBox::Abort );
+    if( QMessageBox::Ignore != msg.exec() ) {
+      return false;
+    }
   }
 
-  // make a new unsorted order
+  beginResetModel();
+
+  vector<QString> col_names( col_names_ );
+  clear_data();
+  col_names_.swap( col_names );
+  columns_.swap( new_columns );
+  num_rows_ = columns_.empty() ? 0 : columns_.front().size();
+  make_sort_order();
+
+  endResetModel();
+
+  return true;
+
+}
+
+// *****************************************************************************************
+// everything but the column names, ready for something new
+void SmivDataTable::clear_data() {
+
+  columns_.clear();
+  num_rows_ = 0;
+  sort_keys_.clear();
+  row_mask_.clear();
   sort_order_.clear();
-  sort_order_.reserve( data_.size() );
-  for( int i = 0 , is = data_.size() ; i < is ; ++i ) {
-    sort_order_.push_back( i );
+  sorted_pos_.clear();
+  name_rows_.clear();
+  name_rows_valid_ = false;
+  // before the file goes, as the job reads it
+  cancel_name_rows_job();
+
+  lazy_ = false;
+  row_cache_.clear();
+  vector<qint64>().swap( rec_starts_ );
+  vector<int>().swap( rec_lines_ );
+  num_fetched_ = 0;
+  data_buf_ = data_buf_end_ = 0;
+  data_contents_.clear();
+  data_file_.reset(); // which unmaps it
+
+}
+
+// *****************************************************************************************
+void SmivDataTable::record_bounds( int rec_num , const char *&rec_start ,
+                                   const char *&rec_end ) const {
+
+  rec_start = data_buf_ + rec_starts_[rec_num];
+  rec_end = rec_num + 1 < int( rec_starts_.size() ) ? data_buf_ + rec_starts_[rec_num + 1] : data_buf_end_;
+  // the newline, and any blank lines after it
+  while( rec_end > rec_start && ( '\n' == rec_end[-1] || '\r' == rec_end[-1] ) ) {
+    --rec_end;
+  }
+
+}
+
+// *****************************************************************************************
+const QStringList *SmivDataTable::record_fields( int rec_num ) const {
+
+  QStringList *fields = row_cache_.object( rec_num );
+  if( fields ) {
+    return fields;
   }
 
+  const char *rec_start , *rec_end;
+  record_bounds( rec_num , rec_start , rec_end );
+  deque<string> unescaped;
+  vector<Field> rec_fields;
+  split_record( rec_start , rec_end , delim_ , unescaped , rec_fields );
+  fields = new QStringList;
+  for( int i = 0 , is = rec_fields.size() ; i < is ; ++i ) {
+    fields->push_back( QString::fromLocal8Bit( rec_fields[i].first , rec_fields[i].second ) );
+  }
+  row_cache_.insert( rec_num , fields );
+
+  return fields;
+
+}
+
+// *****************************************************************************************
+// just the first field of the line, without splitting the rest of it.
+QString SmivDataTable::record_name( int rec_num ) const {
+
+  const char *rec_start , *rec_end;
+  record_bounds( rec_num , rec_start , rec_end );
+  if( rec_start < rec_end && '"' != *rec_start ) {
+    const char *d = static_cast<const char *>( memchr( rec_start , delim_ , rec_end - rec_start ) );
+    return QString::fromLocal8Bit( rec_start , ( d ? d : rec_end ) - rec_start );
+  }
+
+  deque<string> unescaped;
+  vector<Field> rec_fields;
+  split_record( rec_start , rec_end , delim_ , unescaped , rec_fields );
+  return rec_fields.empty() ? QString() :
+                              QString::fromLocal8Bit( rec_fields[0].first , rec_fields[0].second );
+
 }
 
 // *****************************************************************************************
 void SmivDataTable::change_data( int row_num , int col_num , const QVariant &new_val ) {
 
-  if( row_num < rowCount() && col_num < columnCount() ) {
-    data_[row_num][col_num] = pQVar( new QVariant( new_val ) );
+  if( !fetch_all() ) {
+    return;
+  }
+  if( row_num < num_rows_ && col_num < columnCount() ) {
+    columns_[col_num].set_value( row_num , new_val );
+    if( !col_num ) {
+      name_rows_valid_ = false;
+    }
   }
+
 }
 
 // *****************************************************************************************
-int SmivDataTable::get_sorted_row_number( int raw_row_num ) const {
+// Until it's all been read, the names come straight from the file, and the
+// rows are in file order. That could take a while, so it's done in the
+// background.
+int SmivDataTable::row_for_name( const QString &name ) const {
 
-  if( raw_row_num < static_cast<int>( sort_order_.size() ) ) {
-    return sort_order_[raw_row_num];
-  } else {
-    return numeric_limits<int>::max();
+  if( col_names_.empty() ) {
+    return -1;
+  }
+
+  if( !name_rows_valid_ ) {
+    if( lazy_ ) {
+      int gen = name_rows_gen_.loadAcquire();
+      if( name_rows_job_gen_ != gen ) {
+        name_rows_job_gen_ = gen;
+        name_rows_pool_.start( new SmivNameRowsJob( const_cast<SmivDataTable *>( this ) ,
+                                                    num_rows_ , gen ) );
+      }
+      return -1;
+    }
+    name_rows_.clear();
+    name_rows_.reserve( num_rows_ );
+    for( int i = num_rows_ - 1 ; i >= 0 ; --i ) {
+      // backwards, so that the first of any duplicates is the one kept
+      name_rows_.insert( columns_[0].value( i ).toString() , i );
+    }
+    name_rows_valid_ = true;
+  }
+
+  QHash<QString,int>::const_iterator p = name_rows_.find( name );
+  if( p == name_rows_.end() ) {
+    return -1;
   }
+  return lazy_ ? p.value() : sorted_pos_[p.value()];
+
+}
+
+// *****************************************************************************************
+void SmivDataTable::cancel_name_rows_job() {
+
+  name_rows_gen_.fetchAndAddOrdered( 1 );
+  name_rows_pool_.waitForDone();
+  name_rows_job_gen_ = -1;
 
 }
 
 // *****************************************************************************************
-// assumes col_num and numerical type of column has already been verified
-void SmivDataTable::sort_by_number( int col_num , Qt::SortOrder order ) {
+void SmivDataTable::name_rows_built( boost::shared_ptr<QHash<QString,int> > name_rows ,
+                                     int generation ) {
 
-  vector<pair<int,double> > vals;
-  for( int i = 0 , is = rowCount() ; i < is ; ++i ) {
-    vals.push_back( make_pair( i , data_[i][col_num]->toDouble() ) );
+  {
+    QMutexLocker lock( &name_rows_mutex_ );
+    built_name_rows_ = name_rows;
+    built_name_rows_gen_ = generation;
   }
 
-  if( order == Qt::AscendingOrder ) {
-    std::sort( vals.begin() , vals.end() , bind( less<double>() ,
-                                                 bind( &pair<int,double>::second , _1 ) ,
-                                                 bind( &pair<int,double>::second , _2 ) ) );
-  } else {
-    std::sort( vals.begin() , vals.end() , bind( greater<double>() ,
-                                                 bind( &pair<int,double>::second , _1 ) ,
-                                                 bind( &pair<int,double>::second , _2 ) ) );
+  QMetaObject::invokeMethod( this , "slot_name_rows_built" , Qt::QueuedConnection );
+
+}
+
+// *****************************************************************************************
+// a hash made for rows that have since changed is thrown away.
+void SmivDataTable::slot_name_rows_built() {
+
+  boost::shared_ptr<QHash<QString,int> > name_rows;
+  {
+    QMutexLocker lock( &name_rows_mutex_ );
+    if( built_name_rows_gen_ == name_rows_gen_.loadAcquire() ) {
+      name_rows = built_name_rows_;
+    }
+    if( name_rows_job_gen_ == built_name_rows_gen_ ) {
+      name_rows_job_gen_ = -1;
+    }
+    built_name_rows_.reset();
   }
 
-  sort_order_.clear();
-  transform( vals.begin() , vals.end() , back_inserter( sort_order_ ) ,
-             bind( &pair<int,double>::first , _1 ) );
+  if( name_rows && lazy_ && !name_rows_valid_ ) {
+    name_rows_.swap( *name_rows );
+    name_rows_valid_ = true;
+    emit name_rows_ready();
+  }
 
 }
 
 // *****************************************************************************************
-void SmivDataTable::sort_by_string( int col_num , Qt::SortOrder order ) {
+// Each column has its values ranked once, the first time it's sorted on, so
+// a sort is just a stable counting sort of the rows by the ranks for each
+// column, least important first. Rows that are filtered out are dropped at
+// the end.
+void SmivDataTable::make_sort_order() {
+
+  vector<int> rows( num_rows_ ) , sorted_rows( num_rows_ );
+  for( int i = 0 ; i < num_rows_ ; ++i ) {
+    rows[i] = i;
+  }
+  for( int k = sort_keys_.size() - 1 ; k >= 0 ; --k ) {
+    const SmivDataColumn &col = columns_[sort_keys_[k].first];
+    const vector<int> &ranks = col.ranks();
+    int num_ranks = col.num_ranks();
+    // descending just reverses the ranks, leaving the nulls at the end
+    bool descending = Qt::DescendingOrder == sort_keys_[k].second;
+    vector<int> counts( num_ranks + 2 , 0 );
+    for( int i = 0 ; i < num_rows_ ; ++i ) {
+      int r = ranks[i];
+      ++counts[( descending && r < num_ranks ? num_ranks - 1 - r : r ) + 1];
+    }
+    for( int i = 1 , is = counts.size() ; i < is ; ++i ) {
+      counts[i] += counts[i - 1];
+    }
+    for( int i = 0 ; i < num_rows_ ; ++i ) {
+      int r = ranks[rows[i]];
+      sorted_rows[counts[descending && r < num_ranks ? num_ranks - 1 - r : r]++] = rows[i];
+    }
+    rows.swap( sorted_rows );
+  }
 
-  vector<pair<int,string> > vals;
-  for( int i = 0 , is = rowCount() ; i < is ; ++i ) {
-    vals.push_back( make_pair( i , data_[i][col_num]->toString().toStdString() ) );
+  if( !row_mask_.empty() ) {
+    int num_kept = 0;
+    for( int i = 0 ; i < num_rows_ ; ++i ) {
+      if( row_mask_[rows[i]] ) {
+        rows[num_kept++] = rows[i];
+      }
+    }
+    rows.resize( num_kept );
   }
 
-  if( order == Qt::AscendingOrder ) {
-    std::sort( vals.begin() , vals.end() , bind( less<string>() ,
-                                                 bind( &pair<int,string>::second , _1 ) ,
-                                                 bind( &pair<int,string>::second , _2 ) ) );
-  } else {
-    std::sort( vals.begin() , vals.end() , bind( greater<string>() ,
-                                                 bind( &pair<int,string>::second , _1 ) ,
-                                                 bind( &pair<int,string>::second , _2 ) ) );
+  sort_order_.swap( rows );
+  sorted_pos_.assign( num_rows_ , -1 );
+  for( int i = 0 , is = sort_order_.size() ; i < is ; ++i ) {
+    sorted_pos_[sort_order_[i]] = i;
   }
 
-  sort_order_.clear();
-  transform( vals.begin() , vals.end() , back_inserter( sort_order_ ) ,
-             bind( &pair<int,string>::first , _1 ) );
+}
+
+// *****************************************************************************************
+int SmivDataTable::get_sorted_row_number( int raw_row_num ) const {
+
+  if( raw_row_num < static_cast<int>( sort_order_.size() ) ) {
+    return sort_order_[raw_row_num];
+  } else {
+    return numeric_limits<int>::max();
+  }
 
 }
@@ -0,0 +1,52 @@
+//
+// file count_subsearch_hits.cc
+//
+// Runs each of the OESubSearch objects over the molecule, counting the
+// number of unique matches each atom is in. The counts and a comma-separated
+// list of the names of the queries that hit each atom are returned in vectors
+// indexed by DACLIB::atom_index.
+// If it's used from more than one thread, each needs its own copies of the
+// searches, from copy_sub_searches.
+
+#include <string>
+#include <vector>
+
+#include <oechem.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include "DACOEMolAtomIndex.H"
+
+using namespace std;
+using namespace OEChem;
+using namespace OESystem;
+
+namespace DACLIB {
+
+  // **************************************************************************
+  void count_subsearch_hits( OEMolBase &mol ,
+                             const vector<pair<boost::shared_ptr<OESubSearch>,string> > &sub_searches ,
+                             vector<unsigned int> &hit_counts ,
+                             vector<string> &hit_labels ) {
+
+    hit_counts = vector<unsigned int>( DACLIB::max_atom_index( mol ) , 0 );
+    hit_labels = vector<string>( hit_counts.size() );
+
+    for( int i = 0 , is = sub_searches.size() ; i < is ; ++i ) {
+      // unique matches only (that's the true bit in Match)
+      OEIter<OEMatchBase> match = sub_searches[i].first->Match( mol , true );
+      for( ; match ; ++match ) {
+        for( OEIter<OEAtomBase> ma = match->GetTargetAtoms() ; ma ; ++ma ) {
+          unsigned int at_ind = DACLIB::atom_index( *ma );
+          ++hit_counts[at_ind];
+          if( !hit_labels[at_ind].empty() ) {
+            hit_labels[at_ind] += ",";
+          }
+          hit_labels[at_ind] += sub_searches[i].second;
+        }
+      }
+    }
+
+  }
+
+} // EO namespace DACLIB
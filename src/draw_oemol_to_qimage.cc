@@ -16,8 +16,13 @@
 #include <oechem.h>
 #include <oedepict.h>
 
+#include <algorithm>
+#include <limits>
+#include <string>
 #include <vector>
 
+#include <cctype>
+
 #include "DACOEMolAtomIndex.H"
 
 using namespace std;
@@ -88,7 +93,9 @@ void add_bond_colours_to_depiction( OE2DMolDisplay &mol_disp ,
 }
 
 // ****************************************************************************
-OE2DMolDisplay *create_oe_mol_display( QWidget *wid , OEMolBase &mol ,
+// This one doesn't need a widget, just the size of the picture, so it can be
+// used off the GUI thread.
+OE2DMolDisplay *create_oe_mol_display( int width , int height , OEMolBase &mol ,
                                        bool coloured_mol ,
                                        const vector<pair<OEAtomBase * , string> > &atom_labels ,
                                        const vector<pair<OEAtomBase * , QColor> > &atom_colours ,
@@ -97,7 +104,7 @@ OE2DMolDisplay *create_oe_mol_display( QWidget *wid , OEMolBase &mol ,
   OEPrepareDepictionOptions popts;
   OEPrepareDepiction( mol , popts );
 
-  OE2DMolDisplayOptions dopts( double( wid->width() ) , double( wid->height() ) ,
+  OE2DMolDisplayOptions dopts( double( width ) , double( height ) ,
                                OEScale::AutoScale );
   dopts.SetTitleLocation( OETitleLocation::Bottom );
   dopts.SetBondStereoStyle( OEBondStereoStyle::Display::CIPBondStereo );
@@ -126,27 +133,109 @@ OE2DMolDisplay *create_oe_mol_display( QWidget *wid , OEMolBase &mol ,
 }
 
 // ****************************************************************************
+OE2DMolDisplay *create_oe_mol_display( QWidget *wid , OEMolBase &mol ,
+                                       bool coloured_mol ,
+                                       const vector<pair<OEAtomBase * , string> > &atom_labels ,
+                                       const vector<pair<OEAtomBase * , QColor> > &atom_colours ,
+                                       const vector<pair<OEBondBase * , QColor> > &bond_colours ) {
+
+  return create_oe_mol_display( wid->width() , wid->height() , mol , coloured_mol ,
+                                atom_labels , atom_colours , bond_colours );
+
+}
+
+// ****************************************************************************
+// Decode a binary PPM (P6) image straight into the QImage. It's just a short
+// text header followed by raw RGB triplets, so there's no decompression to be
+// done, unlike the PNG that QImage::loadFromData has to inflate. Returns false
+// if the data doesn't look like an 8-bit P6 image, in which case img is left
+// alone.
+bool ppm_to_qimage( const string &ppm , QImage &img ) {
+
+  if( ppm.length() < 2 || ppm[0] != 'P' || ppm[1] != '6' ) {
+    return false;
+  }
+
+  // width, height and maxval, separated by whitespace and possibly comments
+  unsigned int vals[3] = { 0 , 0 , 0 };
+  size_t pos = 2;
+  for( int i = 0 ; i < 3 ; ++i ) {
+    while( pos < ppm.length() ) {
+      if( '#' == ppm[pos] ) {
+        pos = ppm.find( '\n' , pos );
+        if( string::npos == pos ) {
+          return false;
+        }
+      } else if( !isspace( static_cast<unsigned char>( ppm[pos] ) ) ) {
+        break;
+      }
+      ++pos;
+    }
+    if( pos == ppm.length() || !isdigit( static_cast<unsigned char>( ppm[pos] ) ) ) {
+      return false;
+    }
+    while( pos < ppm.length() && isdigit( static_cast<unsigned char>( ppm[pos] ) ) ) {
+      vals[i] = 10 * vals[i] + ( ppm[pos] - '0' );
+      ++pos;
+    }
+  }
+  ++pos; // the single whitespace character before the pixels
+
+  unsigned int width = vals[0] , height = vals[1];
+  if( 255 != vals[2] || !width || !height ||
+      ppm.length() < pos + size_t( 3 ) * width * height ) {
+    return false;
+  }
+
+  img = QImage( width , height , QImage::Format_RGB32 );
+  const unsigned char *pix = reinterpret_cast<const unsigned char *>( ppm.data() ) + pos;
+  for( unsigned int j = 0 ; j < height ; ++j ) {
+    QRgb *line = reinterpret_cast<QRgb *>( img.scanLine( j ) );
+    for( unsigned int i = 0 ; i < width ; ++i , pix += 3 ) {
+      line[i] = qRgb( pix[0] , pix[1] , pix[2] );
+    }
+  }
+
+  return true;
+
+}
+
+// ****************************************************************************
+// OEDepict gives no access to the pixels of its raster surface, so the
+// cheapest way of getting them is as a PPM, which is uncompressed. Only if
+// that's not available do we go through PNG, which is deflated by OEDepict
+// and inflated again by Qt.
 QImage *oe_mol_disp_to_qimage( OE2DMolDisplay &mol_disp ) {
 
-  OEPlatform::oeosstream oes;
-  OERenderMolecule( oes , "PNG" , mol_disp );
+  static const bool have_ppm = OEIsRegisteredImageFile( "PPM" );
 
   QImage *img = new QImage;
-  img->loadFromData( reinterpret_cast<const unsigned char *>( oes.str().c_str() ) , oes.str().length() , "png" );
+  if( have_ppm ) {
+    OEPlatform::oeosstream oes;
+    OERenderMolecule( oes , "PPM" , mol_disp );
+    if( ppm_to_qimage( oes.str() , *img ) ) {
+      return img;
+    }
+  }
+
+  OEPlatform::oeosstream oes;
+  OERenderMolecule( oes , "PNG" , mol_disp );
+  const string png( oes.str() );
+  img->loadFromData( reinterpret_cast<const unsigned char *>( png.data() ) , png.length() , "png" );
 
   return img;
 
 }
 
 // ****************************************************************************
-pair<QImage *,OE2DMolDisplay *> draw_oemol_to_qimage( QWidget *wid , OEMolBase &mol ,
+pair<QImage *,OE2DMolDisplay *> draw_oemol_to_qimage( int width , int height , OEMolBase &mol ,
                                                       bool coloured_mol ,
                                                       const vector<pair<OEAtomBase * , string> > &atom_labels ,
                                                       const vector<pair<OEAtomBase * , QColor> > &atom_colours ,
                                                       const vector<pair<OEBondBase * , QColor> > &bond_colours ) {
 
 
-  OE2DMolDisplay *mol_disp = create_oe_mol_display( wid , mol , coloured_mol ,
+  OE2DMolDisplay *mol_disp = create_oe_mol_display( width , height , mol , coloured_mol ,
                                                     atom_labels , atom_colours ,
                                                     bond_colours );
   QImage *img = oe_mol_disp_to_qimage( *mol_disp );
@@ -155,4 +244,71 @@ pair<QImage *,OE2DMolDisplay *> draw_oemol_to_qimage( QWidget *wid , OEMolBase &
 
 }
 
+// ****************************************************************************
+pair<QImage *,OE2DMolDisplay *> draw_oemol_to_qimage( QWidget *wid , OEMolBase &mol ,
+                                                      bool coloured_mol ,
+                                                      const vector<pair<OEAtomBase * , string> > &atom_labels ,
+                                                      const vector<pair<OEAtomBase * , QColor> > &atom_colours ,
+                                                      const vector<pair<OEBondBase * , QColor> > &bond_colours ) {
+
+  return draw_oemol_to_qimage( wid->width() , wid->height() , mol , coloured_mol ,
+                               atom_labels , atom_colours , bond_colours );
+
+}
+
+// ****************************************************************************
+// A quick sketch of the molecule for previews of big ones: the bonds as
+// plain lines from the 2D coords the molecule already has, plus the title.
+// There are no atom labels, colours or stereo, and no OE2DMolDisplay is
+// made, so it's a small fraction of the cost of the full depiction. The
+// picture is blank if the molecule hasn't got 2D coords.
+QImage *draw_oemol_skeleton_to_qimage( int width , int height , OEMolBase &mol ) {
+
+  QImage *img = new QImage( width , height , QImage::Format_ARGB32_Premultiplied );
+  img->fill( Qt::white );
+  if( 2 != mol.GetDimension() || !mol.NumAtoms() ) {
+    return img;
+  }
+
+  float xy[3];
+  float min_x = numeric_limits<float>::max() , max_x = -numeric_limits<float>::max();
+  float min_y = min_x , max_y = max_x;
+  for( OEIter<OEAtomBase> atom = mol.GetAtoms() ; atom ; ++atom ) {
+    mol.GetCoords( atom , xy );
+    min_x = min( min_x , xy[0] );
+    max_x = max( max_x , xy[0] );
+    min_y = min( min_y , xy[1] );
+    max_y = max( max_y , xy[1] );
+  }
+
+  // leave room at the bottom for the title, as OEDepict does.
+  QPainter qp( img );
+  int title_height = mol.GetTitle()[0] ? qp.fontMetrics().height() : 0;
+  int margin = max( 2 , min( width , height ) / 20 );
+  float draw_width = float( width - 2 * margin );
+  float draw_height = float( height - 2 * margin - title_height );
+  float scale = min( max_x > min_x ? draw_width / ( max_x - min_x ) : draw_width ,
+                     max_y > min_y ? draw_height / ( max_y - min_y ) : draw_height );
+  float mid_x = 0.5F * ( min_x + max_x ) , mid_y = 0.5F * ( min_y + max_y );
+  float cen_x = 0.5F * float( width ) , cen_y = float( margin ) + 0.5F * draw_height;
+
+  // y goes up in the molecule and down on the screen
+  float xy2[3];
+  qp.setPen( Qt::black );
+  for( OEIter<OEBondBase> bond = mol.GetBonds() ; bond ; ++bond ) {
+    mol.GetCoords( bond->GetBgn() , xy );
+    mol.GetCoords( bond->GetEnd() , xy2 );
+    qp.drawLine( QPointF( cen_x + scale * ( xy[0] - mid_x ) , cen_y - scale * ( xy[1] - mid_y ) ) ,
+                 QPointF( cen_x + scale * ( xy2[0] - mid_x ) , cen_y - scale * ( xy2[1] - mid_y ) ) );
+  }
+
+  if( title_height ) {
+    qp.drawText( QRect( 0 , height - margin - title_height , width , title_height ) ,
+                 Qt::AlignCenter , QString( mol.GetTitle() ) );
+  }
+
+  return img;
+
+}
+
 } // EO namespace DACLIB
@@ -8,12 +8,16 @@
 // file of molecules one at a time, and lets the user edit the SMILES,
 // and write a canonical SMILES file out.
 
+#include <iostream>
 #include <string>
 
 #include <QApplication>
+#include <QCoreApplication>
 #include <QMessageBox>
 
 #include "SmiV.H"
+#include "SmiVBatchExport.H"
+#include "SmiVSettings.H"
 
 using namespace std;
 
@@ -24,6 +28,20 @@ namespace DACLIB {
 // *************************************************************************
 int main( int argc , char **argv ) {
 
+  SmiVSettings ss( argc , argv );
+
+  // with --export-dir, it just writes the pictures and stops, without
+  // needing a display.
+  if( ss.batch_export() ) {
+    QCoreApplication a( argc , argv );
+    string err_msg;
+    if( !DACLIB::check_oechem_licence( err_msg ) ) {
+      cerr << "OEChem Licence error :" << endl << err_msg << endl;
+      return 1;
+    }
+    return smiv_batch_export( ss );
+  }
+
   QApplication a( argc , argv );
   SmiV *smiv = new SmiV;
   smiv->setGeometry( 100 , 100 , 500 , 500 );
@@ -36,7 +54,7 @@ int main( int argc , char **argv ) {
     exit( 1 );
   }
 
-  smiv->parse_args( argc , argv );
+  smiv->parse_args( ss );
 
   return a.exec();
 